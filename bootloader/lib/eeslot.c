@@ -0,0 +1,107 @@
+#include <avr/eeprom.h>
+#include "eeslot.h"
+
+#define LEGACY_BOOT_FWUPGD 0x01
+
+uint8_t _eeslot_pos = EESLOT_COUNT-1; // latest record
+uint8_t _eeslot_seq = 0xFF; // sequence number of latest record, 0xFF = none
+eeslot_data_t _eeslot_data = {0xFF, 0};
+
+static inline uint8_t _next_seq(uint8_t seq) {
+	// 0xFF is never used (erased EEPROM)
+	return (seq >= 0xFE) ? 0 : seq+1;
+}
+
+static inline uint8_t _check(uint8_t seq, const eeslot_data_t *data) {
+	return ~(seq ^ data->speed ^ data->flags);
+}
+
+static inline uint8_t* _record(uint8_t pos) {
+	return EESLOT_ADDR + pos*EESLOT_SIZE;
+}
+
+static bool _read_record(uint8_t pos, eeslot_data_t *data) {
+	uint8_t *addr = _record(pos);
+	uint8_t seq = eeprom_read_byte(addr+3);
+	data->speed = eeprom_read_byte(addr);
+	data->flags = eeprom_read_byte(addr+1);
+	return (seq != 0xFF) && (eeprom_read_byte(addr+2) == _check(seq, data));
+}
+
+void eeslot_load(eeslot_data_t *data) {
+	// Find end of sequence
+	uint8_t seq = eeprom_read_byte(_record(0)+3);
+	uint8_t pos = 0;
+	for (uint8_t i = 1; i < EESLOT_COUNT; i++) {
+		uint8_t next = eeprom_read_byte(_record(i)+3);
+		if (next != _next_seq(seq))
+			break;
+		seq = next;
+		pos = i;
+	}
+
+	// Latest record could be damaged by reset during writing → use previous
+	for (uint8_t i = 0; i < 2; i++) {
+		uint8_t p = (pos+EESLOT_COUNT-i) % EESLOT_COUNT;
+		eeslot_data_t record;
+		if (_read_record(p, &record)) {
+			_eeslot_pos = p;
+			_eeslot_seq = eeprom_read_byte(_record(p)+3);
+			_eeslot_data = record;
+			break;
+		}
+	}
+
+	*data = _eeslot_data;
+
+	// Migrate values written by older software
+	bool legacy = false;
+	uint8_t value = eeprom_read_byte(EESLOT_LEGACY_SPEED);
+	if (value != 0xFF) {
+		data->speed = value;
+		legacy = true;
+	}
+	value = eeprom_read_byte(EESLOT_LEGACY_INT_WDRF);
+	if (value != 0xFF) {
+		data->flags = (value & 1) ? (data->flags | EESLOT_FLAG_INT_WDRF) : (data->flags & ~EESLOT_FLAG_INT_WDRF);
+		legacy = true;
+	}
+	value = eeprom_read_byte(EESLOT_LEGACY_BOOT);
+	if (value != 0xFF) {
+		data->flags = (value == LEGACY_BOOT_FWUPGD) ? (data->flags | EESLOT_FLAG_FWUPGD) : (data->flags & ~EESLOT_FLAG_FWUPGD);
+		legacy = true;
+	}
+
+	if (legacy) {
+		eeslot_save(data);
+		eeprom_update_byte(EESLOT_LEGACY_SPEED, 0xFF);
+		eeprom_update_byte(EESLOT_LEGACY_INT_WDRF, 0xFF);
+		eeprom_update_byte(EESLOT_LEGACY_BOOT, 0xFF);
+	}
+}
+
+static void _eeprom_write(uint8_t *addr, uint8_t value) {
+	eeprom_update_byte(addr, value);
+}
+
+void eeslot_save(const eeslot_data_t *data) {
+	eeslot_save_via(data, _eeprom_write);
+}
+
+void eeslot_save_via(const eeslot_data_t *data, eeslot_write_t write) {
+	if ((_eeslot_seq != 0xFF) && (data->speed == _eeslot_data.speed) && (data->flags == _eeslot_data.flags))
+		return;
+
+	uint8_t seq = _next_seq(_eeslot_seq);
+	uint8_t pos = (_eeslot_seq == 0xFF) ? 0 : (_eeslot_pos+1) % EESLOT_COUNT;
+	uint8_t *addr = _record(pos);
+
+	write(addr, data->speed);
+	write(addr+1, data->flags);
+	write(addr+2, _check(seq, data));
+	write(addr+3, seq); // record valid from now
+
+	_eeslot_pos = pos;
+	_eeslot_seq = seq;
+	_eeslot_data = *data;
+}
@@ -11,6 +11,7 @@
 #include "io.h"
 #include "../lib/crc16modbus.h"
 #include "../lib/mtbbus.h"
+#include "../lib/eeslot.h"
 
 /* All boot_* functions executing SPM instruction need to be called in
  * ATOMIC_BLOCK - interrupts need to be disabled during execution of the function,
@@ -37,17 +38,12 @@ static void mtbbus_send_error(uint8_t code);
 ///////////////////////////////////////////////////////////////////////////////
 // Defines & global variables
 
-#define EEPROM_ADDR_MTBBUS_SPEED           ((uint8_t*)0x01)
-#define EEPROM_ADDR_BOOT                   ((uint8_t*)0x03)
 #define EEPROM_ADDR_BOOTLOADER_VER_MAJOR   ((uint8_t*)0x08)
 #define EEPROM_ADDR_BOOTLOADER_VER_MINOR   ((uint8_t*)0x09)
 
-#define CONFIG_BOOT_NORMAL 0x00
-#define CONFIG_BOOT_FWUPGD 0x01
-
 #define CONFIG_MODULE_TYPE 0x15
 #define CONFIG_FW_MAJOR 1
-#define CONFIG_FW_MINOR 3
+#define CONFIG_FW_MINOR 4
 #define CONFIG_PROTO_MAJOR 4
 #define CONFIG_PROTO_MINOR 0
 
@@ -71,6 +67,8 @@ volatile uint8_t subpage = 0xFF;
 volatile bool page_erase = false;
 volatile bool page_write = false;
 
+eeslot_data_t eeslot; // MTBbus speed & boot flags
+
 ///////////////////////////////////////////////////////////////////////////////
 
 int main() {
@@ -89,14 +87,17 @@ int main() {
 	ETIMSK = (1 << OCIE3A); // enable compare match interrupt
 	OCR3A = 23020;
 
-	uint8_t boot = eeprom_read_byte(EEPROM_ADDR_BOOT);
-	if (boot != CONFIG_BOOT_NORMAL)
-		eeprom_write_byte(EEPROM_ADDR_BOOT, CONFIG_BOOT_NORMAL);
+	eeslot_load(&eeslot);
+	bool fwupgd = eeslot.flags & EESLOT_FLAG_FWUPGD;
+	if (fwupgd) {
+		eeslot.flags &= ~EESLOT_FLAG_FWUPGD;
+		eeslot_save(&eeslot);
+	}
 
 	eeprom_update_byte(EEPROM_ADDR_BOOTLOADER_VER_MAJOR, CONFIG_FW_MAJOR);
 	eeprom_update_byte(EEPROM_ADDR_BOOTLOADER_VER_MINOR, CONFIG_FW_MINOR);
 
-	if ((boot != CONFIG_BOOT_FWUPGD) && (io_button()))
+	if ((!fwupgd) && (io_button()))
 		check_and_boot();
 
 	// Not booting → start MTBbus
@@ -134,7 +135,7 @@ int main() {
 }
 
 static inline void _mtbbus_init(void) {
-	uint8_t mtbbus_speed = eeprom_read_byte(EEPROM_ADDR_MTBBUS_SPEED);
+	uint8_t mtbbus_speed = eeslot.speed;
 	if (mtbbus_speed > MTBBUS_SPEED_MAX)
 		mtbbus_speed = MTBBUS_SPEED_38400;
 
@@ -204,7 +205,8 @@ void mtbbus_received(bool broadcast, uint8_t command_code, uint8_t *data, uint8_
 		mtbbus_set_speed(data[0]);
 		if (!broadcast)
 			mtbbus_send_ack();
-		eeprom_update_byte(EEPROM_ADDR_MTBBUS_SPEED, data[0]);
+		eeslot.speed = data[0];
+		eeslot_save(&eeslot);
 
 	} else if ((command_code == MTBBUS_CMD_MOSI_WRITE_FLASH) && (data_len >= 66) && (!broadcast)) {
 		uint8_t _page = data[0];
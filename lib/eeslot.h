@@ -0,0 +1,44 @@
+#ifndef _EESLOT_H_
+#define _EESLOT_H_
+
+/* Wear-levelled storage of frequently written fields (MTBbus speed, boot
+ * flags) in EEPROM. Shared by firmware & bootloader, keep both copies same.
+ *
+ * Fields are stored in a ring of EESLOT_COUNT records, each write goes to
+ * the next record. Records carry sequence number (written last) & check
+ * byte. Latest record is the one whose successor does not continue the
+ * sequence, so it's found by reading EESLOT_COUNT bytes at most.
+ *
+ * Older firmware & bootloaders store these fields in separate cells at
+ * addresses 0x01-0x03. Any non-0xFF value there is newer than the ring
+ * (written by older software), it's moved to the ring & the cell erased.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define EESLOT_ADDR ((uint8_t*)0xF00)
+#define EESLOT_COUNT 16
+#define EESLOT_SIZE 4 // speed, flags, check, seq
+
+#define EESLOT_LEGACY_SPEED ((uint8_t*)0x01)
+#define EESLOT_LEGACY_INT_WDRF ((uint8_t*)0x02)
+#define EESLOT_LEGACY_BOOT ((uint8_t*)0x03)
+
+#define EESLOT_FLAG_INT_WDRF 0x01 // last watchdog reset was intentional
+#define EESLOT_FLAG_FWUPGD 0x02 // bootloader should wait for firmware upgrade
+
+typedef struct {
+	uint8_t speed; // 0xFF = not set
+	uint8_t flags;
+} eeslot_data_t;
+
+void eeslot_load(eeslot_data_t *data);
+void eeslot_save(const eeslot_data_t *data); // writes only when data changed
+
+// Same as eeslot_save, bytes are written by ‹write› in given order (e.g.
+// queued for writing from EEPROM ready interrupt)
+typedef void (*eeslot_write_t)(uint8_t *addr, uint8_t value);
+void eeslot_save_via(const eeslot_data_t *data, eeslot_write_t write);
+
+#endif
@@ -6,6 +6,7 @@
 #include "mtbbus.h"
 #include "../src/io.h"
 #include "crc16modbus.h"
+#include "../src/prof.h"
 
 volatile uint8_t mtbbus_output_buf[MTBBUS_OUTPUT_BUF_MAX_SIZE];
 volatile uint8_t mtbbus_output_buf_size = 0;
@@ -117,6 +118,10 @@ void mtbbus_update() {
 	}
 }
 
+bool mtbbus_pending() {
+	return received || sent;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Sending
 
@@ -204,6 +209,7 @@ static void _send_next_byte() {
 }
 
 ISR(USART0_TX_vect) {
+	PROF_ISR_BEGIN();
 	if (mtbbus_next_byte_to_send < mtbbus_output_buf_size) {
 		_send_next_byte();
 	} else {
@@ -211,6 +217,7 @@ ISR(USART0_TX_vect) {
 		sending = false;
 		sent = true;
 	}
+	PROF_ISR_END(PROF_ISR_UART_TX);
 }
 
 bool mtbbus_can_fill_output_buf() {
@@ -221,17 +228,18 @@ bool mtbbus_can_fill_output_buf() {
 // Receiving
 
 ISR(USART0_RX_vect) {
+	PROF_ISR_BEGIN();
 	uint8_t status = UCSR0A;
 	bool ninth = (UCSR0B >> 1) & 0x01;
 	uint8_t data = UDR0;
 
-	if (status & ((1<<FE0)|(1<<DOR0)|(1<<UPE0)))
-		return; // return on error
-
-	if (ninth)
-		_mtbbus_received_ninth(data);
-	else
-		_mtbbus_received_non_ninth(data);
+	if (!(status & ((1<<FE0)|(1<<DOR0)|(1<<UPE0)))) { // ignore on error
+		if (ninth)
+			_mtbbus_received_ninth(data);
+		else
+			_mtbbus_received_non_ninth(data);
+	}
+	PROF_ISR_END(PROF_ISR_UART_RX);
 }
 
 static inline void _mtbbus_received_ninth(uint8_t data) {
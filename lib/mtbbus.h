@@ -36,6 +36,7 @@ typedef enum {
 void mtbbus_init(uint8_t addr, uint8_t speed);
 void mtbbus_set_speed(uint8_t speed);
 void mtbbus_update();
+bool mtbbus_pending(); // true iff mtbbus_update has work to do
 
 bool mtbbus_can_fill_output_buf();
 int mtbbus_send(uint8_t *data, uint8_t size);
@@ -86,6 +87,15 @@ int mtbbus_send_buf();
 #define MTBBUS_DV_MTBBUS_BAD_CRC 17
 #define MTBBUS_DV_MTBBUS_SENT 18
 #define MTBBUS_DV_MTBBUS_UNSENT 19
+#define MTBBUS_DV_FIRST_RESPONSE 20
+#define MTBBUS_DV_SCHED_OVERRUNS 21
+#define MTBBUS_DV_PROF_TASKS 22
+#define MTBBUS_DV_PROF_ISRS 23
+#define MTBBUS_DV_CPU_LOAD 24
+#define MTBBUS_DV_RAM 25
+#define MTBBUS_DV_WAKE_LATENCY 26
+#define MTBBUS_DV_CLOCK 27
+#define MTBBUS_DV_SYNC_TIME 28
 
 #ifdef SUP_MTBBUS_DIAG
 typedef struct {
@@ -0,0 +1,41 @@
+#include <stddef.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+#include "clock.h"
+
+volatile uint32_t _clock_ms = 0; // at last Timer 3 compare match
+
+void clock_tick(void) {
+	_clock_ms += CLOCK_TICK_MS;
+}
+
+static inline uint16_t _elapsed_us(uint16_t elapsed_ticks) {
+	// Elapsed time could be > 10 ms in case Timer 3 ISR is pending
+	return ((uint32_t)elapsed_ticks * 10000) / T3_PERIOD_10MS;
+}
+
+uint32_t clock_read(uint16_t *us) {
+	uint32_t ms;
+	uint16_t elapsed;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		ms = _clock_ms;
+		elapsed = TCNT3 - (OCR3A - T3_PERIOD_10MS);
+	}
+	uint16_t elapsed_us = _elapsed_us(elapsed);
+	if (us != NULL)
+		*us = elapsed_us % 1000;
+	return ms + elapsed_us / 1000;
+}
+
+uint32_t clock_ms(void) {
+	return clock_read(NULL);
+}
+
+void clock_align(void) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		uint16_t now = TCNT3;
+		_clock_ms += _elapsed_us(now - (OCR3A - T3_PERIOD_10MS)) / 1000;
+		OCR3A = now + T3_PERIOD_10MS;
+		ETIFR = (1 << OCF3A); // pending tick already counted above
+	}
+}
@@ -0,0 +1,27 @@
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+/* Monotonic clock since start of firmware. Clock is incremented each 10 ms
+ * from Timer 3 compare ISR, sub-ms part is read from free-running Timer 3.
+ * All timeouts are implemented as deadlines in clock ms.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define T3_PERIOD_10MS 18432 // F_CPU / 8 / 100
+#define CLOCK_TICK_MS 10
+
+void clock_tick(void); // call from Timer 3 ISR each 10 ms
+
+uint32_t clock_ms(void);
+uint32_t clock_read(uint16_t *us); // returns ms, ‹us› = 0-999 within current ms (may be NULL)
+
+// Restart 10 ms period of Timer 3 now, clock stays monotonic (sub-ms part is lost)
+void clock_align(void);
+
+static inline bool clock_reached(uint32_t deadline) {
+	return (int32_t)(clock_ms() - deadline) >= 0;
+}
+
+#endif
@@ -1,12 +1,38 @@
 #include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
+#include <stddef.h>
 #include <string.h>
 #include "config.h"
 #include "../lib/mtbbus.h"
+#include "../lib/eeslot.h"
+#include "../lib/crc16modbus.h"
+#include "prof.h"
 
 uint8_t config_safe_state[NO_OUTPUTS];
 uint8_t config_inputs_delay[NO_INPUTS/2];
-bool config_write = false;
 uint8_t config_mtbbus_speed;
+uint8_t config_scom_flags;
+uint8_t config_scom_period;
+uint8_t config_scom_gap;
+uint8_t config_pwm_fade;
+uint8_t config_failover_timeout;
+config_pattern_t config_patterns[CONFIG_PATTERNS];
+config_scene_t config_scenes[CONFIG_SCENES];
+config_rule_t config_rules[CONFIG_RULES];
+
+static const config_pattern_t _default_patterns[CONFIG_PATTERNS] PROGMEM = {
+	{0x0000FFFF, 3}, // wig-wag (use with offset 2 on second output), ~1 Hz
+	{0x000001C7, 3}, // double flash
+	{0x00071C71, 2}, // triple flash
+	{0x00000001, 3}, // strobe
+	{0x00000FFF, 6}, // long on, short off
+	{0x55555555, 1}, // 50 Hz
+	{0x33333333, 1}, // 25 Hz
+	{0x0F0F0F0F, 1}, // 12.5 Hz
+};
 
 #define EEPROM_ADDR_VERSION                ((uint8_t*)0x00)
 #define EEPROM_ADDR_MTBBUS_SPEED           ((uint8_t*)0x01)
@@ -16,56 +42,633 @@ uint8_t config_mtbbus_speed;
 #define EEPROM_ADDR_BOOTLOADER_VER_MINOR   ((uint8_t*)0x09)
 #define EEPROM_ADDR_SAFE_STATE             ((uint8_t*)0x10)
 #define EEPROM_ADDR_INPUTS_DELAY           ((uint8_t*)0x20)
+#define EEPROM_ADDR_SCOM_FLAGS             ((uint8_t*)0x28)
+#define EEPROM_ADDR_SCOM_PERIOD            ((uint8_t*)0x29)
+#define EEPROM_ADDR_SCOM_GAP               ((uint8_t*)0x2A)
+#define EEPROM_ADDR_PWM_FADE               ((uint8_t*)0x2B)
+#define EEPROM_ADDR_FAILOVER_TIMEOUT       ((uint8_t*)0x2C)
+#define EEPROM_ADDR_PATTERNS               ((uint8_t*)0x40)
+#define EEPROM_ADDR_SCENES                 ((uint8_t*)0x70)
+#define EEPROM_ADDR_RULES                  ((uint8_t*)0x100) // legacy layout up to here
+
+
+// Configuration is stored in two slots, each with sequence number & CRC.
+// Changes are always written to the inactive slot, which becomes active
+// after it's fully written (sequence number is written last). Newest valid
+// slot is loaded, so reset during writing never damages configuration.
+#define SLOT_A_START 0x200 // after legacy layout
+#define SLOT_SIZE 0x200
+#define EEPROM_ADDR_SLOT_A                 ((uint8_t*)SLOT_A_START)
+#define EEPROM_ADDR_SLOT_B                 ((uint8_t*)(SLOT_A_START+SLOT_SIZE))
+#define SLOT_CRC 0 // 2 bytes, over data & sequence number
+#define SLOT_SEQ 2
+#define SLOT_DATA 4
+
+// Configuration data in slot are tagged: format version byte, records
+// (tag, count, element size, data) & 0xFF terminator. Unknown records are
+// skipped & missing ones keep default values when loading, so layout can
+// be extended without losing configuration.
+#define CONFIG_TAG_END 0xFF
+#define SLOT_CAPACITY (SLOT_SIZE - SLOT_DATA)
+#define REC_HEADER 3
+
+typedef struct {
+	uint8_t tag; // elements have tags tag .. tag+count-1
+	uint16_t offset; // of data (record header is just before)
+	void* data;
+	uint8_t size; // of single element
+	uint8_t count;
+} config_item_t;
+
+#define CD_SAFE_STATE (1 + REC_HEADER)
+#define CD_INPUTS_DELAY (CD_SAFE_STATE + NO_OUTPUTS + REC_HEADER)
+#define CD_SCOM_FLAGS (CD_INPUTS_DELAY + NO_INPUTS/2 + REC_HEADER)
+#define CD_SCOM_PERIOD (CD_SCOM_FLAGS + 1 + REC_HEADER)
+#define CD_SCOM_GAP (CD_SCOM_PERIOD + 1 + REC_HEADER)
+#define CD_PWM_FADE (CD_SCOM_GAP + 1 + REC_HEADER)
+#define CD_FAILOVER_TIMEOUT (CD_PWM_FADE + 1 + REC_HEADER)
+#define CD_PATTERNS (CD_FAILOVER_TIMEOUT + 1 + REC_HEADER)
+#define CD_SCENES (CD_PATTERNS + sizeof(config_patterns) + REC_HEADER)
+#define CD_RULES (CD_SCENES + sizeof(config_scenes) + REC_HEADER)
+#define CD_END (CD_RULES + sizeof(config_rules))
+#define CONFIG_DATA_SIZE (CD_END + 1)
+
+static const config_item_t _config_layout[] PROGMEM = {
+	{CONFIG_TAG_SAFE_STATE, CD_SAFE_STATE, config_safe_state, 1, NO_OUTPUTS},
+	{CONFIG_TAG_INPUTS_DELAY, CD_INPUTS_DELAY, config_inputs_delay, 1, NO_INPUTS/2},
+	{CONFIG_TAG_SCOM_FLAGS, CD_SCOM_FLAGS, &config_scom_flags, 1, 1},
+	{CONFIG_TAG_SCOM_PERIOD, CD_SCOM_PERIOD, &config_scom_period, 1, 1},
+	{CONFIG_TAG_SCOM_GAP, CD_SCOM_GAP, &config_scom_gap, 1, 1},
+	{CONFIG_TAG_PWM_FADE, CD_PWM_FADE, &config_pwm_fade, 1, 1},
+	{CONFIG_TAG_FAILOVER_TIMEOUT, CD_FAILOVER_TIMEOUT, &config_failover_timeout, 1, 1},
+	{CONFIG_TAG_PATTERNS, CD_PATTERNS, config_patterns, sizeof(config_pattern_t), CONFIG_PATTERNS},
+	{CONFIG_TAG_SCENES, CD_SCENES, config_scenes, sizeof(config_scene_t), CONFIG_SCENES},
+	{CONFIG_TAG_RULES, CD_RULES, config_rules, sizeof(config_rule_t), CONFIG_RULES},
+};
+#define CONFIG_LAYOUT_ITEMS (sizeof(_config_layout)/sizeof(*_config_layout))
+
+// Compile-time checks of EEPROM layout (C99 has no static assert)
+#define CONFIG_STATIC_ASSERT(cond, name) typedef char _config_assert_##name[(cond) ? 1 : -1]
+CONFIG_STATIC_ASSERT(CONFIG_DATA_SIZE <= SLOT_CAPACITY, data_fits_slot);
+CONFIG_STATIC_ASSERT(0x100 + sizeof(config_rules) <= SLOT_A_START, legacy_before_slots);
+CONFIG_STATIC_ASSERT(SLOT_A_START + 2*SLOT_SIZE <= 0xF00, slots_before_eeslot); // EESLOT_ADDR
+CONFIG_STATIC_ASSERT(sizeof(config_scene_t) <= 0xFF, element_size_in_record);
+
+uint8_t _active = 0; // slot with currently valid config
+uint8_t _seq = 0; // sequence number of active slot
+
+// Write-behind: changed bytes are marked in dirty bitmap of each slot
+// (indexed by offset in data) & written to the inactive slot from EEPROM
+// ready interrupt, single byte compared & written per interrupt. Slot is
+// committed from main loop when all it's dirty bytes are written.
+
+uint8_t _dirty[2][(CONFIG_DATA_SIZE+7)/8];
+volatile uint16_t _dirty_count[2] = {0, 0};
+uint16_t _dirty_pos = 0; // next offset to check
+bool _commit_pending = false;
+uint8_t _commit_step = 0;
+uint16_t _commit_crc;
+uint16_t _config_crc; // CRC of config data, updated on commit (see config_crc)
+
+// Direct writes (boot flags, MTBbus speed) are queued & written from EEPROM
+// ready interrupt in order, before configuration data.
+#define DIRECT_QUEUE_SIZE 8
+typedef struct {
+	uint8_t* addr;
+	uint8_t value;
+} direct_write_t;
+direct_write_t _direct_queue[DIRECT_QUEUE_SIZE];
+volatile uint8_t _direct_count = 0;
+uint8_t _direct_first = 0;
+
+uint16_t _bootloader_version;
+
+// MTBbus speed & boot flags are stored in wear-levelled slots shared with
+// bootloader, older bootloaders support only fixed cells.
+#define BOOTLOADER_EESLOT_MIN 0x0104
+bool _eeslot = false;
+eeslot_data_t _hot;
+
+static void _write_direct(uint8_t* addr, uint8_t value);
+static void _hot_save(void);
+static void _speed_save(void);
+static void _load_legacy(void);
+static void _load_defaults(void);
+
+static uint8_t _config_byte(uint16_t offset);
+static uint16_t _config_crc_calc(void);
+
+///////////////////////////////////////////////////////////////////////////////
+
+static inline uint8_t* _slot_addr(uint8_t slot) {
+	return (slot == 0) ? EEPROM_ADDR_SLOT_A : EEPROM_ADDR_SLOT_B;
+}
+
+static inline uint8_t _inactive(void) {
+	return _active ^ 1;
+}
+
+static inline uint8_t _next_seq(uint8_t seq) {
+	return (seq >= 0xFE) ? 0 : seq+1; // 0xFF = empty slot
+}
+
+static uint16_t _slot_data_crc(uint8_t slot, uint8_t seq, uint16_t len) {
+	uint8_t* addr = _slot_addr(slot);
+	uint16_t crc = 0;
+	for (uint16_t i = 0; i < len; i++)
+		crc = crc16modbus_byte(crc, eeprom_read_byte(addr+SLOT_DATA+i));
+	return crc16modbus_byte(crc, seq);
+}
+
+// CRC of layout item ‹i› (record header & data) as stored in slot, from RAM
+static uint16_t _item_crc(uint16_t crc, uint8_t i) {
+	config_item_t item;
+	memcpy_P(&item, &_config_layout[i], sizeof(item));
+	crc = crc16modbus_byte(crc, item.tag);
+	crc = crc16modbus_byte(crc, item.count);
+	crc = crc16modbus_byte(crc, item.size);
+	return crc16modbus_bytes(crc, item.data, item.size*item.count);
+}
+
+// Returns length of data in slot (incl. terminator), 0 = malformed
+static uint16_t _slot_data_len(uint8_t slot) {
+	uint8_t* data = _slot_addr(slot)+SLOT_DATA;
+	if (eeprom_read_byte(data) == 0xFF)
+		return 0;
+	uint16_t pos = 1;
+	while (pos < SLOT_CAPACITY) {
+		if (eeprom_read_byte(data+pos) == CONFIG_TAG_END)
+			return pos+1;
+		if (pos+REC_HEADER > SLOT_CAPACITY)
+			return 0;
+		pos += REC_HEADER + eeprom_read_byte(data+pos+1)*eeprom_read_byte(data+pos+2);
+	}
+	return 0;
+}
+
+static bool _slot_valid(uint8_t slot, uint8_t *seq, uint16_t *crc, uint16_t *len) {
+	uint8_t* addr = _slot_addr(slot);
+	*seq = eeprom_read_byte(addr+SLOT_SEQ);
+	*crc = eeprom_read_word((uint16_t*)(addr+SLOT_CRC));
+	*len = _slot_data_len(slot);
+	return (*seq != 0xFF) && (*len > 0) && (_slot_data_crc(slot, *seq, *len) == *crc);
+}
+
+static void _slot_load(uint8_t slot) {
+	uint8_t* data = _slot_addr(slot)+SLOT_DATA;
+	uint16_t pos = 1;
+	uint8_t tag;
+	while ((tag = eeprom_read_byte(data+pos)) != CONFIG_TAG_END) {
+		uint8_t count = eeprom_read_byte(data+pos+1);
+		uint8_t size = eeprom_read_byte(data+pos+2);
+		pos += REC_HEADER;
+
+		for (uint8_t i = 0; i < CONFIG_LAYOUT_ITEMS; i++) {
+			config_item_t item;
+			memcpy_P(&item, &_config_layout[i], sizeof(item));
+			if (item.tag != tag)
+				continue;
+			for (uint8_t j = 0; (j < count) && (j < item.count); j++)
+				eeprom_read_block((uint8_t*)item.data + j*item.size, data+pos+j*size,
+				                  (size < item.size) ? size : item.size);
+		}
 
+		pos += count*size;
+	}
+}
+
+static void _mark_all_dirty(uint8_t slot) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		memset(_dirty[slot], 0, sizeof(_dirty[slot]));
+		for (uint16_t i = 0; i < CONFIG_DATA_SIZE; i++)
+			_dirty[slot][i/8] |= (1 << (i%8));
+		_dirty_count[slot] = CONFIG_DATA_SIZE;
+	}
+}
 
 void config_load(void) {
-	uint8_t version = eeprom_read_byte(EEPROM_ADDR_VERSION);
-	if (version == 0xFF) {
-		// default EEPROM content → reset config
+	// Read before any write-behind starts (EEPROM registers not shared)
+	_bootloader_version = (eeprom_read_byte(EEPROM_ADDR_BOOTLOADER_VER_MAJOR) << 8) |
+	                      (eeprom_read_byte(EEPROM_ADDR_BOOTLOADER_VER_MINOR));
+	if (_bootloader_version == 0xFFFF)
+		_bootloader_version = 0x0101;
+	_eeslot = (_bootloader_version >= BOOTLOADER_EESLOT_MIN);
+	if (_eeslot)
+		eeslot_load(&_hot);
+
+	config_mtbbus_speed = (_eeslot) ? _hot.speed : eeprom_read_byte(EEPROM_ADDR_MTBBUS_SPEED);
+	if (config_mtbbus_speed > MTBBUS_SPEED_MAX)
 		config_mtbbus_speed = MTBBUS_SPEED_38400;
-		memset(config_safe_state, 0, NO_OUTPUTS);
-		memset(config_inputs_delay, 0, NO_INPUTS/2);
-		while (!config_save()); // loop until everything saved
+	config_boot_normal();
+
+	uint8_t seq[2];
+	uint16_t crc[2];
+	uint16_t len[2];
+	bool valid[2];
+	for (uint8_t i = 0; i < 2; i++)
+		valid[i] = _slot_valid(i, &seq[i], &crc[i], &len[i]);
+
+	if ((valid[0]) || (valid[1])) {
+		if ((valid[0]) && (valid[1]))
+			_active = ((int8_t)(seq[1] - seq[0]) > 0) ? 1 : 0;
+		else
+			_active = (valid[1]) ? 1 : 0;
+		_seq = seq[_active];
+
+		_load_defaults(); // for records missing in slot
+		_slot_load(_active);
+		config_scom_check();
+
+		_mark_all_dirty(_inactive()); // content of inactive slot unknown
+		if ((len[_active] != CONFIG_DATA_SIZE) ||
+		    (eeprom_read_byte(_slot_addr(_active)+SLOT_DATA) != CONFIG_FORMAT_VERSION)) {
+			// saved by firmware with other layout → rewrite in current one
+			_commit_pending = true;
+			EECR |= (1 << EERIE);
+		}
+		_config_crc = _config_crc_calc();
 		return;
 	}
 
-	config_mtbbus_speed = eeprom_read_byte(EEPROM_ADDR_MTBBUS_SPEED);
-	if (config_mtbbus_speed > MTBBUS_SPEED_MAX)
+	// No valid slot
+	_active = 1;
+	_seq = 0xFF;
+	if (eeprom_read_byte(EEPROM_ADDR_VERSION) == 0xFF) {
+		// default EEPROM content → reset config
 		config_mtbbus_speed = MTBBUS_SPEED_38400;
+		_speed_save();
+		_load_defaults();
+		config_save_all();
+	} else {
+		// config saved by older firmware → move to slot
+		_load_legacy();
+		_mark_all_dirty(_inactive());
+		_commit_pending = true;
+		EECR |= (1 << EERIE);
+	}
+	_config_crc = _config_crc_calc();
+}
 
-	uint8_t boot = eeprom_read_byte(EEPROM_ADDR_BOOT);
-	if (boot != CONFIG_BOOT_NORMAL)
-		eeprom_write_byte(EEPROM_ADDR_BOOT, CONFIG_BOOT_NORMAL);
+static void _load_defaults(void) {
+	memset(config_safe_state, 0, NO_OUTPUTS);
+	memset(config_inputs_delay, 0, NO_INPUTS/2);
+	config_scom_flags = 0;
+	config_scom_period = CONFIG_SCOM_PERIOD_DEFAULT;
+	config_scom_gap = CONFIG_SCOM_GAP_DEFAULT;
+	config_pwm_fade = 0;
+	config_failover_timeout = 0;
+	memcpy_P(config_patterns, _default_patterns, sizeof(config_patterns));
+	memset(config_scenes, 0, sizeof(config_scenes));
+	memset(config_rules, 0xFF, sizeof(config_rules)); // all rules disabled
+}
 
+static void _load_legacy(void) {
 	eeprom_read_block(config_safe_state, EEPROM_ADDR_SAFE_STATE, NO_OUTPUTS);
 	eeprom_read_block(config_inputs_delay, EEPROM_ADDR_INPUTS_DELAY, NO_INPUTS/2);
+
+	config_scom_flags = eeprom_read_byte(EEPROM_ADDR_SCOM_FLAGS);
+	if (config_scom_flags == 0xFF) // not saved by older firmware
+		config_scom_flags = 0;
+	config_scom_period = eeprom_read_byte(EEPROM_ADDR_SCOM_PERIOD);
+	config_scom_gap = eeprom_read_byte(EEPROM_ADDR_SCOM_GAP);
+	config_scom_check();
+
+	config_pwm_fade = eeprom_read_byte(EEPROM_ADDR_PWM_FADE);
+	if (config_pwm_fade == 0xFF) // not saved by older firmware
+		config_pwm_fade = 0;
+
+	config_failover_timeout = eeprom_read_byte(EEPROM_ADDR_FAILOVER_TIMEOUT);
+	if (config_failover_timeout > CONFIG_FAILOVER_TIMEOUT_MAX) // incl. not saved by older firmware
+		config_failover_timeout = 0;
+
+	eeprom_read_block(config_patterns, EEPROM_ADDR_PATTERNS, sizeof(config_patterns));
+	for (uint8_t i = 0; i < CONFIG_PATTERNS; i++)
+		if ((config_patterns[i].period == 0) || (config_patterns[i].period == 0xFF)) // not saved by older firmware
+			memcpy_P(&config_patterns[i], &_default_patterns[i], sizeof(config_pattern_t));
+
+	eeprom_read_block(config_scenes, EEPROM_ADDR_SCENES, sizeof(config_scenes));
+	for (uint8_t i = 0; i < CONFIG_SCENES; i++) {
+		bool empty = true; // not saved by older firmware
+		for (uint8_t j = 0; j < sizeof(config_scene_t); j++)
+			if (((uint8_t*)&config_scenes[i])[j] != 0xFF)
+				empty = false;
+		if (empty)
+			memset(&config_scenes[i], 0, sizeof(config_scene_t));
+	}
+
+	// Rules not saved by older firmware are disabled (output 0xFF)
+	eeprom_read_block(config_rules, EEPROM_ADDR_RULES, sizeof(config_rules));
 }
 
-bool config_save(void) {
-	// Saves only 1 byte at a time, so this function never blocks for a long time (EEPROM busy wait).
-	// Returns true iff all data have been succesfully saved.
-	// If false is returned, call 'config_save' again to really save all data.
+void config_changed(const void* data, uint16_t size) {
+	if (data == &config_mtbbus_speed) {
+		_speed_save();
+		return;
+	}
 
-	if (!eeprom_is_ready())
-		return false;
-	eeprom_update_byte(EEPROM_ADDR_VERSION, 1);
-	if (!eeprom_is_ready())
+	for (uint8_t i = 0; i < CONFIG_LAYOUT_ITEMS; i++) {
+		config_item_t item;
+		memcpy_P(&item, &_config_layout[i], sizeof(item));
+		if (((uint8_t*)data < (uint8_t*)item.data) ||
+		    ((uint8_t*)data >= (uint8_t*)item.data + item.size*item.count))
+			continue;
+
+		uint16_t offset = item.offset + ((uint8_t*)data - (uint8_t*)item.data);
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			for (uint16_t j = 0; j < size; j++, offset++) {
+				for (uint8_t slot = 0; slot < 2; slot++) {
+					if (!(_dirty[slot][offset/8] & (1 << (offset%8)))) {
+						_dirty[slot][offset/8] |= (1 << (offset%8));
+						_dirty_count[slot]++;
+					}
+				}
+			}
+		}
+		_commit_pending = true;
+		_commit_step = 0; // CRC must be calculated again
+		EECR |= (1 << EERIE);
+		return;
+	}
+}
+
+bool config_commit_ready(void) {
+	if (!_commit_pending)
 		return false;
-	eeprom_update_byte(EEPROM_ADDR_MTBBUS_SPEED, config_mtbbus_speed);
+	uint16_t count;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { count = _dirty_count[_inactive()]; }
+	return (count == 0); // else EEPROM ready interrupt is writing data
+}
+
+void config_update(void) {
+	// Commit inactive slot when all it's data are written. CRC is calculated
+	// from RAM (same as written data, any change restarts commit), single
+	// layout item per call, so main loop is never blocked for long. CRC &
+	// sequence number (last) are written by EEPROM ready interrupt before
+	// any other data, so the other slot is not touched before commit.
+	if (!config_commit_ready())
+		return;
 
-	for (uint8_t i = 0; i < NO_OUTPUTS; i++) {
-		if (!eeprom_is_ready())
-			return false;
-		eeprom_update_byte(EEPROM_ADDR_SAFE_STATE+i, config_safe_state[i]);
+	if (_commit_step < CONFIG_LAYOUT_ITEMS) {
+		if (_commit_step == 0)
+			_commit_crc = crc16modbus_byte(0, CONFIG_FORMAT_VERSION);
+		_commit_crc = _item_crc(_commit_crc, _commit_step);
+		_commit_step++;
+		return;
+	}
+
+	uint8_t slot = _inactive();
+	uint8_t* addr = _slot_addr(slot);
+	uint8_t seq = _next_seq(_seq);
+	_config_crc = crc16modbus_byte(_commit_crc, CONFIG_TAG_END);
+	uint16_t crc = crc16modbus_byte(_config_crc, seq);
+	_write_direct(addr+SLOT_CRC, crc & 0xFF);
+	_write_direct(addr+SLOT_CRC+1, crc >> 8);
+	_write_direct(addr+SLOT_SEQ, seq);
+
+	_active = slot;
+	_seq = seq;
+	_commit_step = 0;
+	_commit_pending = false;
+}
+
+bool config_pending(void) {
+	return (_commit_pending) || (_direct_count > 0) || (!eeprom_is_ready());
+}
+
+void config_flush(void) {
+	while (config_pending()) {
+		config_update();
+		wdt_reset();
+	}
+}
+
+void config_save_all(void) {
+	// Blocking, used before EEPROM ready interrupt is enabled
+	uint8_t slot = _inactive();
+	uint8_t* addr = _slot_addr(slot);
+	uint8_t seq = _next_seq(_seq);
+	for (uint16_t i = 0; i < CONFIG_DATA_SIZE; i++)
+		eeprom_update_byte(addr+SLOT_DATA+i, _config_byte(i));
+	uint16_t crc = _slot_data_crc(slot, seq, CONFIG_DATA_SIZE);
+	eeprom_update_word((uint16_t*)(addr+SLOT_CRC), crc);
+	eeprom_update_byte(addr+SLOT_SEQ, seq);
+
+	_active = slot;
+	_seq = seq;
+	_mark_all_dirty(_inactive());
+}
+
+static uint8_t _config_byte(uint16_t offset) {
+	if (offset == 0)
+		return CONFIG_FORMAT_VERSION;
+	for (uint8_t i = 0; i < CONFIG_LAYOUT_ITEMS; i++) {
+		config_item_t item;
+		memcpy_P(&item, &_config_layout[i], sizeof(item));
+		if (offset < item.offset-REC_HEADER)
+			break;
+		if (offset < item.offset) { // record header
+			uint8_t header[REC_HEADER] = {item.tag, item.count, item.size};
+			return header[offset-(item.offset-REC_HEADER)];
+		}
+		if (offset < item.offset + item.size*item.count)
+			return ((uint8_t*)item.data)[offset-item.offset];
+	}
+	return CONFIG_TAG_END;
+}
+
+// Layout item of last byte written by interrupt: dirty bytes are written in
+// increasing order, so lookup of byte value is O(1) amortized.
+uint8_t _isr_item = 0;
+config_item_t _isr_item_data;
+bool _isr_item_valid = false;
+
+static uint8_t _config_byte_isr(uint16_t offset) {
+	if ((!_isr_item_valid) || (offset < _isr_item_data.offset-REC_HEADER)) {
+		_isr_item = 0;
+		memcpy_P(&_isr_item_data, &_config_layout[0], sizeof(_isr_item_data));
+		_isr_item_valid = true;
+	}
+	while ((offset >= _isr_item_data.offset + _isr_item_data.size*_isr_item_data.count) &&
+	       (_isr_item+1 < CONFIG_LAYOUT_ITEMS)) {
+		_isr_item++;
+		memcpy_P(&_isr_item_data, &_config_layout[_isr_item], sizeof(_isr_item_data));
+	}
+
+	if (offset == 0)
+		return CONFIG_FORMAT_VERSION;
+	if (offset < _isr_item_data.offset-REC_HEADER)
+		return CONFIG_TAG_END; // not reached, items are contiguous
+	if (offset < _isr_item_data.offset) {
+		uint8_t header[REC_HEADER] = {_isr_item_data.tag, _isr_item_data.count, _isr_item_data.size};
+		return header[offset-(_isr_item_data.offset-REC_HEADER)];
+	}
+	if (offset < _isr_item_data.offset + _isr_item_data.size*_isr_item_data.count)
+		return ((uint8_t*)_isr_item_data.data)[offset-_isr_item_data.offset];
+	return CONFIG_TAG_END;
+}
+
+static inline void _eeprom_write_isr(uint16_t addr, uint8_t value) {
+	EEAR = addr;
+	EECR |= (1 << EERE);
+	if (EEDR != value) {
+		EEDR = value;
+		EECR |= (1 << EEMWE);
+		EECR |= (1 << EEWE); // interrupt fires again when write is finished
+	}
+}
+
+ISR(EE_READY_vect) {
+	PROF_ISR_BEGIN();
+	uint8_t slot = _inactive();
+
+	if (_direct_count > 0) {
+		direct_write_t write = _direct_queue[_direct_first];
+		_direct_first = (_direct_first+1) % DIRECT_QUEUE_SIZE;
+		_direct_count--;
+		_eeprom_write_isr((uint16_t)(uintptr_t)write.addr, write.value);
+
+	} else if (_dirty_count[slot] > 0) {
+		// Skip whole clean bytes of bitmap: at most sizeof(_dirty[slot]) steps
+		uint8_t byte = _dirty_pos/8;
+		uint8_t bits = _dirty[slot][byte] & (0xFF << (_dirty_pos%8));
+		while (bits == 0) {
+			byte++;
+			if (byte >= sizeof(_dirty[slot]))
+				byte = 0;
+			bits = _dirty[slot][byte];
+		}
+		uint8_t bit = 0;
+		while (!(bits & (1 << bit)))
+			bit++;
+		_dirty_pos = 8*byte + bit;
+
+		_dirty[slot][byte] &= ~(1 << bit);
+		_dirty_count[slot]--;
+		_eeprom_write_isr((uint16_t)(uintptr_t)(_slot_addr(slot)+SLOT_DATA+_dirty_pos),
+		                  _config_byte_isr(_dirty_pos));
+
+	} else {
+		EECR &= ~(1 << EERIE); // nothing to write
+	}
+	PROF_ISR_END(PROF_ISR_EE_READY);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Tagged access to single elements of configuration
+
+static uint8_t* _tag_element(uint8_t tag, uint8_t *size) {
+	for (uint8_t i = 0; i < CONFIG_LAYOUT_ITEMS; i++) {
+		config_item_t item;
+		memcpy_P(&item, &_config_layout[i], sizeof(item));
+		if ((tag >= item.tag) && (tag < item.tag+item.count)) {
+			*size = item.size;
+			return (uint8_t*)item.data + (tag-item.tag)*item.size;
+		}
 	}
+	return NULL;
+}
+
+static bool _tag_value_valid(uint8_t tag, const uint8_t* value) {
+	if (tag == CONFIG_TAG_SCOM_PERIOD)
+		return (value[0] >= CONFIG_SCOM_PERIOD_MIN);
+	if (tag == CONFIG_TAG_SCOM_GAP)
+		return (value[0] > 0) && (value[0] <= CONFIG_SCOM_GAP_MAX);
+	if (tag == CONFIG_TAG_FAILOVER_TIMEOUT)
+		return (value[0] <= CONFIG_FAILOVER_TIMEOUT_MAX);
+	if ((tag >= CONFIG_TAG_PATTERNS) && (tag < CONFIG_TAG_PATTERNS+CONFIG_PATTERNS)) {
+		uint8_t period = ((const config_pattern_t*)value)->period;
+		return (period > 0) && (period != 0xFF); // 0xFF = not saved by older firmware
+	}
+	return true;
+}
+
+static inline bool _tag_in(uint8_t tag, uint8_t first, uint8_t count) {
+	return (tag >= first) && (tag < first+count);
+}
+
+static void _reverse(uint8_t* data, uint8_t len) {
+	for (uint8_t i = 0; i < len/2; i++) {
+		uint8_t tmp = data[i];
+		data[i] = data[len-1-i];
+		data[len-1-i] = tmp;
+	}
+}
 
-	for (uint8_t i = 0; i < NO_INPUTS/2; i++) {
-		if (!eeprom_is_ready())
-			return false;
-		eeprom_update_byte(EEPROM_ADDR_INPUTS_DELAY+i, config_inputs_delay[i]);
+// Multi-byte fields are big-endian in records (same as in MTBBUS_SPEC_*
+// commands), elements in memory are little-endian. Conversion is same in
+// both directions.
+static void _tlv_byte_order(uint8_t tag, uint8_t* value) {
+	if (_tag_in(tag, CONFIG_TAG_SCENES, CONFIG_SCENES))
+		_reverse(value, sizeof(((config_scene_t*)0)->mask));
+	else if (_tag_in(tag, CONFIG_TAG_PATTERNS, CONFIG_PATTERNS))
+		_reverse(value, sizeof(((config_pattern_t*)0)->steps));
+	else if (_tag_in(tag, CONFIG_TAG_RULES, CONFIG_RULES)) {
+		_reverse(value, sizeof(((config_rule_t*)0)->on));
+		_reverse(value+offsetof(config_rule_t, off), sizeof(((config_rule_t*)0)->off));
 	}
+}
+
+uint8_t config_tlv_set(const uint8_t* data, uint8_t len) {
+	// Whole message is checked first, so it's applied either fully or not at all
+	for (uint8_t pass = 0; pass < 2; pass++) {
+		uint8_t i = 0;
+		while (i < len) {
+			if (i+2 > len)
+				return CONFIG_TLV_MALFORMED;
+			uint8_t tag = data[i];
+			uint8_t size;
+			uint8_t* element = _tag_element(tag, &size);
+			if (element == NULL)
+				return CONFIG_TLV_UNKNOWN_TAG;
+			if ((data[i+1] != size) || (i+2+size > len) || (!_tag_value_valid(tag, data+i+2)))
+				return CONFIG_TLV_MALFORMED;
+
+			if (pass == 1) {
+				memcpy(element, data+i+2, size);
+				_tlv_byte_order(tag, element);
+				config_changed(element, size);
+			}
+			i += 2+size;
+		}
+	}
+	return CONFIG_TLV_OK;
+}
+
+uint8_t config_tlv_get(uint8_t tag, uint8_t* buf, uint8_t max, uint8_t *len) {
+	uint8_t size;
+	uint8_t* element = _tag_element(tag, &size);
+	if (element == NULL)
+		return CONFIG_TLV_UNKNOWN_TAG;
+	if (2+size > max)
+		return CONFIG_TLV_MALFORMED;
+	buf[0] = tag;
+	buf[1] = size;
+	memcpy(buf+2, element, size);
+	_tlv_byte_order(tag, buf+2);
+	*len = 2+size;
+	return CONFIG_TLV_OK;
+}
+
+static uint16_t _config_crc_calc(void) {
+	// Same as CRC of slot data without sequence number, but from RAM
+	uint16_t crc = crc16modbus_byte(0, CONFIG_FORMAT_VERSION);
+	for (uint8_t i = 0; i < CONFIG_LAYOUT_ITEMS; i++)
+		crc = _item_crc(crc, i);
+	return crc16modbus_byte(crc, CONFIG_TAG_END);
+}
 
-	return eeprom_is_ready(); // true iff no write done
+uint16_t config_crc(void) {
+	return _config_crc;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void config_scom_check(void) {
+	// 0xFF = not saved by older firmware → default
+	if ((config_scom_period < CONFIG_SCOM_PERIOD_MIN) || (config_scom_period == 0xFF))
+		config_scom_period = CONFIG_SCOM_PERIOD_DEFAULT;
+	if ((config_scom_gap == 0) || (config_scom_gap > CONFIG_SCOM_GAP_MAX))
+		config_scom_gap = CONFIG_SCOM_GAP_DEFAULT;
 }
 
 uint8_t input_delay(uint8_t input) {
@@ -75,24 +678,69 @@ uint8_t input_delay(uint8_t input) {
 	return (input%2 == 0) ? both & 0x0F : (both >> 4) & 0x0F;
 }
 
+// Fields below are written via direct queue, so callers (MTBbus handlers)
+// are never blocked by EEPROM writing.
+static void _write_direct(uint8_t* addr, uint8_t value) {
+	if (!(SREG & (1 << SREG_I))) { // init: interrupt can't write yet
+		eeprom_update_byte(addr, value);
+		return;
+	}
+	while (_direct_count >= DIRECT_QUEUE_SIZE)
+		wdt_reset(); // wait for interrupt to free space (never happens in practice)
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		_direct_queue[(_direct_first+_direct_count) % DIRECT_QUEUE_SIZE] = (direct_write_t){addr, value};
+		_direct_count++;
+	}
+	EECR |= (1 << EERIE);
+}
+
+static void _hot_save(void) {
+	eeslot_save_via(&_hot, _write_direct);
+}
+
+static void _speed_save(void) {
+	if (_eeslot) {
+		_hot.speed = config_mtbbus_speed;
+		_hot_save();
+	} else {
+		_write_direct(EEPROM_ADDR_MTBBUS_SPEED, config_mtbbus_speed);
+	}
+}
+
 void config_boot_fwupgd(void) {
-	eeprom_update_byte(EEPROM_ADDR_BOOT, CONFIG_BOOT_FWUPGD);
+	if (_eeslot) {
+		_hot.flags |= EESLOT_FLAG_FWUPGD;
+		_hot_save();
+	} else {
+		_write_direct(EEPROM_ADDR_BOOT, CONFIG_BOOT_FWUPGD);
+	}
 }
 
 void config_boot_normal(void) {
-	eeprom_update_byte(EEPROM_ADDR_BOOT, CONFIG_BOOT_NORMAL);
+	if (_eeslot) {
+		_hot.flags &= ~EESLOT_FLAG_FWUPGD;
+		_hot_save();
+	} else {
+		_write_direct(EEPROM_ADDR_BOOT, CONFIG_BOOT_NORMAL);
+	}
 }
 
 void config_int_wdrf(bool value) {
-	eeprom_update_byte(EEPROM_ADDR_INT_WDRF, value);
+	if (_eeslot) {
+		_hot.flags = (value) ? (_hot.flags | EESLOT_FLAG_INT_WDRF) : (_hot.flags & ~EESLOT_FLAG_INT_WDRF);
+		_hot_save();
+	} else {
+		_write_direct(EEPROM_ADDR_INT_WDRF, value);
+	}
 }
 
 bool config_is_int_wdrf(void) {
+	if (_eeslot)
+		return _hot.flags & EESLOT_FLAG_INT_WDRF;
 	return eeprom_read_byte(EEPROM_ADDR_INT_WDRF) & 1;
 }
 
 uint16_t config_bootloader_version() {
-	uint16_t version = (eeprom_read_byte(EEPROM_ADDR_BOOTLOADER_VER_MAJOR) << 8) |
-	                   (eeprom_read_byte(EEPROM_ADDR_BOOTLOADER_VER_MINOR));
-	return version == 0xFFFF ? 0x0101 : version;
+	return _bootloader_version;
 }
@@ -8,14 +8,59 @@
 #include <stdbool.h>
 #include "io.h"
 
+#define CONFIG_PATTERNS 8
+#define CONFIG_PATTERN_STEPS 32
+
+typedef struct {
+	uint32_t steps; // bit i = output state in step i
+	uint8_t period; // length of single step in 10 ms
+} config_pattern_t;
+
+#define CONFIG_SCENES 8
+
+typedef struct {
+	uint16_t mask; // outputs set by scene
+	uint8_t states[NO_OUTPUTS];
+} config_scene_t;
+
+#define CONFIG_RULES 8
+
+// Condition: all bits of ‹on› & no bits of ‹off› are set in vector of
+// inputs (bits 0-15) & active outputs (bits 16-31).
+typedef struct {
+	uint32_t on;
+	uint32_t off;
+	uint8_t output; // 0xFF = rule disabled
+	uint8_t state_true; // output state set when condition becomes true
+	uint8_t state_false; // output state set when condition becomes false, 0xFF = none
+	uint8_t delay; // condition must hold for this time before state_true is set (100 ms)
+} config_rule_t;
+
 extern uint8_t config_safe_state[NO_OUTPUTS];
 extern uint8_t config_inputs_delay[NO_INPUTS/2];
-extern bool config_write;
 extern uint8_t config_mtbbus_speed;
+extern uint8_t config_scom_flags;
+extern uint8_t config_scom_period; // bit period of serial code outputs in 100 us
+extern uint8_t config_scom_gap; // gap between serial code frames in bit periods
+extern uint8_t config_pwm_fade; // 10 ms periods per single step of fading, 0 = no fading
+extern uint8_t config_failover_timeout; // safe state after no MTBbus traffic for this time (50 ms), 0 = never
+extern config_pattern_t config_patterns[CONFIG_PATTERNS];
+extern config_scene_t config_scenes[CONFIG_SCENES];
+extern config_rule_t config_rules[CONFIG_RULES];
 
 // Warning: these functions take long time to execute
 void config_load(void);
-bool config_save(void);
+void config_save_all(void); // blocking
+
+// Call after changing config variable (or it's part) to save it to EEPROM.
+// Changed bytes are written in background from EEPROM ready interrupt.
+// Changes are written to inactive slot, which becomes active by
+// config_update once all changed bytes are written.
+void config_changed(const void* data, uint16_t size);
+bool config_commit_ready(void); // true iff config_update has work to do
+void config_update(void);
+bool config_pending(void); // true iff background writing in progress
+void config_flush(void); // wait until everything is written
 
 void config_boot_fwupgd(void);
 void config_boot_normal(void);
@@ -25,7 +70,37 @@ bool config_is_int_wdrf(void);
 
 uint16_t config_bootloader_version(void);
 
+// Tagged configuration: each element (single output's safe state, single
+// pattern, ...) has it's own tag. Records (tag, length, value) allow to
+// set or read any subset of configuration; value has same format as in
+// MTBBUS_SPEC_SET_PATTERN/SET_SCENE/SET_RULE (multi-byte fields big-endian).
+// Same tags are used in EEPROM, where elements are stored as in memory.
+#define CONFIG_FORMAT_VERSION 1
+
+#define CONFIG_TAG_SCOM_FLAGS 0x01
+#define CONFIG_TAG_SCOM_PERIOD 0x02
+#define CONFIG_TAG_SCOM_GAP 0x03
+#define CONFIG_TAG_PWM_FADE 0x04
+#define CONFIG_TAG_FAILOVER_TIMEOUT 0x05
+#define CONFIG_TAG_SAFE_STATE 0x10 // + output
+#define CONFIG_TAG_INPUTS_DELAY 0x20 // + input/2 (2 inputs in single byte)
+#define CONFIG_TAG_PATTERNS 0x30 // + pattern
+#define CONFIG_TAG_SCENES 0x40 // + scene
+#define CONFIG_TAG_RULES 0x50 // + rule
+
+#define CONFIG_TLV_OK 0
+#define CONFIG_TLV_UNKNOWN_TAG 1
+#define CONFIG_TLV_MALFORMED 2 // bad length, invalid value, no space
+
+// Functions return CONFIG_TLV_*, nothing is set in case of error
+uint8_t config_tlv_set(const uint8_t* data, uint8_t len);
+uint8_t config_tlv_get(uint8_t tag, uint8_t* buf, uint8_t max, uint8_t *len);
+// CRC of whole tagged configuration, same on modules with same config.
+// Cached: updated when changes are committed (config_pending() is false).
+uint16_t config_crc(void);
+
 uint8_t input_delay(uint8_t input);
+void config_scom_check(void); // sets default S-COM timing in case of invalid values
 
 #define CONFIG_MODULE_TYPE 0x16
 #define CONFIG_FW_MAJOR 1
@@ -36,4 +111,14 @@ uint8_t input_delay(uint8_t input);
 #define CONFIG_BOOT_FWUPGD 0x01
 #define CONFIG_BOOT_NORMAL 0x00
 
+// Serial code outputs flags (S-COM & other encoders)
+#define CONFIG_SCOM_IMMEDIATE 0x01 // start new frame on output as soon as it's code changes
+
+#define CONFIG_SCOM_PERIOD_DEFAULT 100 // 10 ms
+#define CONFIG_SCOM_PERIOD_MIN 5 // 0.5 ms
+#define CONFIG_SCOM_GAP_DEFAULT 20
+#define CONFIG_SCOM_GAP_MAX 200
+
+#define CONFIG_FAILOVER_TIMEOUT_MAX 200 // 10 s
+
 #endif
@@ -2,6 +2,8 @@
 #include <avr/interrupt.h>
 #include <avr/boot.h>
 #include "diag.h"
+#include "prof.h"
+#include "clock.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 // Global variables
@@ -13,6 +15,7 @@ mtbbus_warn_flags_t mtbbus_warn_flags_old = {0};
 volatile uint16_t vcc_voltage = 0;
 volatile uint16_t init_vcc = 0xFFFF;
 volatile uint32_t uptime_seconds = 0;
+uint16_t ram_free_min = 0xFFFF;
 
 #define DIAG_STEP_VCC_READY 0
 #define DIAG_STEP_VCC_MEASURE 1
@@ -25,6 +28,8 @@ volatile uint8_t diag_step = DIAG_STEP_OVER-1;
 
 static inline void vcc_prepare_measure(void);
 static inline void adc_start(void);
+static inline void stack_check(void);
+void stack_paint(void) __attribute__((naked, used, section(".init1")));
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -44,20 +49,67 @@ void diag_update(void) {
 		break;
 	}
 
-	{
-		static uint8_t uptime_counter = 0;
-		uptime_counter++;
-		if (uptime_counter >= 10) {
-			uptime_seconds++;
-			uptime_counter = 0;
-		}
-	}
+	uptime_seconds = clock_ms() / 1000;
+
+	stack_check();
 
 	diag_step++;
 	if (diag_step >= DIAG_STEP_OVER)
 		diag_step = 0;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Stack usage
+
+#define STACK_PAINT 0xC5
+#define STACK_CHECK_STEP 256 // bytes checked in single call of stack_check
+
+extern uint8_t _end; // end of .bss
+extern uint8_t __stack; // top of RAM
+
+#define _STR(x) #x
+#define STR(x) _STR(x)
+
+// Runs before stack pointer & zero register (r1) are initialized, so it's
+// written in assembly: fills RAM from _end up to __stack (incl.).
+void stack_paint(void) {
+	__asm__ volatile (
+		"ldi r30, lo8(_end)\n\t"
+		"ldi r31, hi8(_end)\n\t"
+		"ldi r26, lo8(__stack+1)\n\t"
+		"ldi r27, hi8(__stack+1)\n\t"
+		"ldi r24, " STR(STACK_PAINT) "\n\t"
+		"1: st Z+, r24\n\t"
+		"cp r30, r26\n\t"
+		"cpc r31, r27\n\t"
+		"brne 1b\n\t"
+	);
+}
+
+uint8_t *_stack_check_pos = &_end;
+
+void stack_check(void) {
+	// Free RAM = painted bytes from end of static data up to first byte
+	// overwritten by stack. RAM is checked in steps, so this never takes long.
+	for (uint16_t i = 0; i < STACK_CHECK_STEP; i++) {
+		if ((_stack_check_pos > &__stack) || (*_stack_check_pos != STACK_PAINT)) {
+			uint16_t free = _stack_check_pos - &_end;
+			if (free < ram_free_min) {
+				ram_free_min = free;
+				if (free < RAM_FREE_WARN)
+					mtbbus_warn_flags.bits.low_ram = true;
+			}
+			_stack_check_pos = &_end;
+			return;
+		}
+		_stack_check_pos++;
+	}
+}
+
+uint16_t ram_static_size(void) {
+	return &_end - (uint8_t*)RAMSTART;
+}
+
 void vcc_prepare_measure(void) {
 	ADMUX = (1 << REFS0); // AVCC with external capacitor at AREF pin
 	ADMUX |= 0x1E; // measure internal 1V22 band-gap reference
@@ -68,6 +120,7 @@ void adc_start(void) {
 }
 
 ISR(ADC_vect) {
+	PROF_ISR_BEGIN();
 	uint16_t value = ADCL;
 	value |= (ADCH << 8);
 
@@ -83,4 +136,5 @@ ISR(ADC_vect) {
 			mtbbus_warn_flags.bits.vcc_oscilating = true;
 		break;
 	}
+	PROF_ISR_END(PROF_ISR_ADC);
 }
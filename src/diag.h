@@ -39,6 +39,8 @@ typedef union {
 		bool jtrf : 1;
 		bool missed_timer : 1;
 		bool vcc_oscilating : 1;
+		bool comm_lost : 1;
+		bool low_ram : 1;
 	} bits;
 	uint8_t all;
 } mtbbus_warn_flags_t;
@@ -50,7 +52,7 @@ void diag_init(void);
 void diag_update(void); // called each 100 ms
 void vcc_start_measure(void);
 
-#define DIAG_UPDATE_PERIOD 10 // 100 ms
+#define DIAG_UPDATE_PERIOD 100 // ms
 extern volatile uint16_t vcc_voltage;
 #define VCC_MAX_DIFF 10 // 0.2 V
 
@@ -59,4 +61,10 @@ extern uint8_t ts_offset;
 extern uint8_t ts_gain;
 extern volatile uint32_t uptime_seconds;
 
+// RAM between static data & deepest stack pointer seen (RAM is painted at
+// startup and checked continuously in diag_update).
+extern uint16_t ram_free_min;
+uint16_t ram_static_size(void); // .data + .bss
+#define RAM_FREE_WARN 256 // low_ram warning below this
+
 #endif
@@ -0,0 +1,160 @@
+#include <string.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "encoder.h"
+#include "config.h"
+#include "prof.h"
+
+typedef struct {
+	uint32_t bits; // LSB is sent first, 1 = output active
+	uint8_t length; // number of bit periods without gap, 0 = not coding anything
+} enc_frame_t;
+
+typedef void (*enc_encode_t)(uint8_t code, enc_frame_t* frame);
+
+static void scom_encode(uint8_t code, enc_frame_t* frame);
+static void pulses_encode(uint8_t code, enc_frame_t* frame);
+
+// Indexed by ENC_* constants
+static const enc_encode_t _encoders[] = {
+	scom_encode,
+	pulses_encode,
+};
+
+enc_frame_t _frames[NO_OUTPUTS]; // frames being sent
+enc_frame_t _frames_new[NO_OUTPUTS]; // frames to be sent after current frame ends
+uint32_t _shift[NO_OUTPUTS]; // rest of bits of current frame
+
+// Each output has it's own phase, so a changed output could start new frame
+// without disturbing frames being sent on other outputs.
+uint8_t _phases[NO_OUTPUTS] = {0, };
+
+uint16_t _period_ticks; // in timer 3 ticks
+
+#define ENC_MIN_GAP 3 // minimal gap between frames in immediate-restart mode
+
+static void encoder_update(void);
+
+static inline bool _frame_eq(const enc_frame_t* a, const enc_frame_t* b) {
+	return (a->length == b->length) && (a->bits == b->bits);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void encoder_init(void) {
+	encoder_reset();
+	encoder_apply_config();
+	OCR3B = TCNT3 + _period_ticks;
+}
+
+void encoder_apply_config(void) {
+	uint16_t ticks = ((uint32_t)config_scom_period * (F_CPU/8)) / 10000; // period in 100 us
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		_period_ticks = ticks;
+	}
+}
+
+ISR(TIMER3_COMPB_vect) {
+	// Bit period according to config, independent of 10 ms timer
+	PROF_ISR_BEGIN();
+	OCR3B += _period_ticks;
+	encoder_update();
+	PROF_ISR_END(PROF_ISR_TIMER3B);
+}
+
+static void encoder_update(void) {
+	// Output bits of all encoders are collected into single mask & written at once
+	uint16_t outputs = 0;
+	uint16_t mask = 0;
+	bool immediate = config_scom_flags & CONFIG_SCOM_IMMEDIATE;
+	uint8_t gap = config_scom_gap;
+
+	for (int i = NO_OUTPUTS-1; i >= 0; i--) {
+		outputs <<= 1;
+		mask <<= 1;
+
+		enc_frame_t* frame = &_frames[i];
+
+		if ((immediate) && (!_frame_eq(frame, &_frames_new[i])) &&
+		    ((frame->length == 0) || (_phases[i] >= frame->length+ENC_MIN_GAP))) {
+			// new frame pending & current frame finished → start new frame now
+			*frame = _frames_new[i];
+			_shift[i] = frame->bits;
+			_phases[i] = 0;
+		}
+
+		if (frame->length > 0) {
+			mask |= 1;
+			if (_shift[i] & 1)
+				outputs |= 1;
+			_shift[i] >>= 1;
+		}
+
+		_phases[i]++;
+		if (_phases[i] >= frame->length+gap) {
+			*frame = _frames_new[i];
+			_shift[i] = frame->bits;
+			_phases[i] = 0;
+		}
+	}
+
+	if (mask)
+		io_set_outputs_raw_mask(outputs, mask);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void encoder_reset(void) {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		memset(_frames, 0, sizeof(_frames));
+		memset(_frames_new, 0, sizeof(_frames_new));
+		memset(_shift, 0, sizeof(_shift));
+	}
+}
+
+void encoder_output(uint8_t output, uint8_t encoder, uint8_t code) {
+	if ((output >= NO_OUTPUTS) || (encoder >= sizeof(_encoders)/sizeof(*_encoders)))
+		return;
+
+	enc_frame_t frame;
+	_encoders[encoder](code, &frame);
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		_frames_new[output] = frame; // enabling | setting different code → buffer
+	}
+}
+
+void encoder_disable_output(uint8_t output) {
+	if (output >= NO_OUTPUTS)
+		return;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		_frames[output].length = 0; // disable immediately
+		_frames_new[output].length = 0;
+		_shift[output] = 0;
+	}
+}
+
+bool encoder_is_output(uint8_t output) {
+	if (output >= NO_OUTPUTS)
+		return false;
+	return _frames[output].length > 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Encoders
+
+static void scom_encode(uint8_t code, enc_frame_t* frame) {
+	// start bits 1 & 0, 7 inverted data bits, stop bit 1
+	frame->bits = 1 | ((uint32_t)(~code & 0x7F) << 2) | ((uint32_t)1 << 9);
+	frame->length = 10;
+}
+
+static void pulses_encode(uint8_t code, enc_frame_t* frame) {
+	// ‹code› pulses of single bit period separated by single bit period
+	if (code > ENC_PULSES_MAX)
+		code = ENC_PULSES_MAX;
+	frame->bits = 0;
+	for (uint8_t i = 0; i < code; i++)
+		frame->bits |= (uint32_t)1 << (2*i);
+	frame->length = (code == 0) ? 1 : 2*code;
+}
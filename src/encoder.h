@@ -0,0 +1,26 @@
+#ifndef _ENCODER_H_
+#define _ENCODER_H_
+
+/* Serial code outputs (S-COM & other pulse-train encodings).
+ * Each encoder converts code to a frame of bits; frames of all outputs are
+ * sent bit by bit in TIMER3_COMPB interrupt. Timer 3 must be running in
+ * normal mode with 8× prescaler. Bit period & gap between frames is taken
+ * from config (common for all encoders).
+ */
+
+#include <stdbool.h>
+#include "io.h"
+
+#define ENC_SCOM 0 // code 0-127
+#define ENC_PULSES 1 // code = number of pulses in frame
+#define ENC_PULSES_MAX 15
+
+void encoder_init(void);
+void encoder_apply_config(void); // call when timing in config changes
+
+void encoder_reset(void);
+void encoder_output(uint8_t output, uint8_t encoder, uint8_t code);
+void encoder_disable_output(uint8_t output);
+bool encoder_is_output(uint8_t output);
+
+#endif
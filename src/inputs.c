@@ -13,6 +13,7 @@ bool btn_pressed = false;
 uint8_t _inputs_debounce_counter[NO_INPUTS] = {0, };
 uint8_t _inputs_fall_counter[NO_INPUTS] = {0, };
 uint8_t _btn_debounce_counter = 0;
+uint8_t _inputs_settle_counter = 0; // debounce runs since start, up to DEBOUNCE_THRESHOLD
 
 
 static void _inputs_button_debounce_update();
@@ -51,6 +52,24 @@ void inputs_debounce_update(void) {
 	}
 
 	_inputs_button_debounce_update();
+
+	if (_inputs_settle_counter < DEBOUNCE_THRESHOLD)
+		_inputs_settle_counter++;
+}
+
+bool inputs_settled(void) {
+	return (_inputs_settle_counter >= DEBOUNCE_THRESHOLD);
+}
+
+void inputs_warm_restore(uint16_t state) {
+	inputs_logic_state = state;
+	inputs_debounced_state = state;
+	inputs_old = state;
+	_inputs_settle_counter = DEBOUNCE_THRESHOLD;
+	for (size_t i = 0; i < NO_INPUTS; i++) {
+		_inputs_debounce_counter[i] = (state & 1) ? DEBOUNCE_THRESHOLD : 0;
+		state >>= 1;
+	}
 }
 
 void inputs_fall_update(void) {
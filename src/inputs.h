@@ -22,7 +22,14 @@ extern uint16_t inputs_old;
 // This function should be called each 100 us
 void inputs_debounce_update(void);
 
+// Returns true after first full debounce window, i.e. when state of inputs
+// corresponds to real inputs
+bool inputs_settled(void);
+
 // This function should be called each 10 ms
 void inputs_fall_update(void);
 
+// Set state of inputs as already debounced (after warm restart)
+void inputs_warm_restore(uint16_t state);
+
 #endif
@@ -1,5 +1,6 @@
 #include <avr/io.h>
 #include <util/delay.h>
+#include <util/atomic.h>
 
 #include "io.h"
 #include "common.h"
@@ -27,12 +28,7 @@ uint16_t io_get_inputs_raw(void) {
 }
 
 void io_set_output_raw(uint8_t onum, bool state) {
-	uint16_t outputs = io_get_outputs_raw();
-	if (state)
-		outputs |= (1 << onum);
-	else
-		outputs &= ~(1 << onum);
-	io_set_outputs_raw(outputs);
+	io_set_outputs_raw_mask(state ? (1 << onum) : 0, 1 << onum);
 }
 
 void io_set_outputs_raw(uint16_t state) {
@@ -40,11 +36,14 @@ void io_set_outputs_raw(uint16_t state) {
 }
 
 void io_set_outputs_raw_mask(uint16_t state, uint16_t mask) {
-	state = (state & mask) | (io_get_outputs_raw() & (~mask));
-	uint8_t low = state & 0xFF;
-	uint8_t high = (state >> 8) & 0xFF;
-	PORTD = bit_reverse(low);
-	PORTC = bit_reverse(high);
+	// Outputs are set from interrupts too (S-COM), so read-modify-write must be atomic
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		state = (state & mask) | (io_get_outputs_raw() & (~mask));
+		uint8_t low = state & 0xFF;
+		uint8_t high = (state >> 8) & 0xFF;
+		PORTD = bit_reverse(low);
+		PORTC = bit_reverse(high);
+	}
 }
 
 uint16_t io_get_outputs_raw(void) {
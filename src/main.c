@@ -6,15 +6,25 @@
 #include <avr/interrupt.h>
 #include <avr/io.h>
 #include <avr/wdt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
 #include <string.h>
 
 #include "common.h"
 #include "io.h"
-#include "scom.h"
+#include "encoder.h"
 #include "outputs.h"
+#include "pwm.h"
 #include "config.h"
 #include "inputs.h"
 #include "diag.h"
+#include "rules.h"
+#include "warm.h"
+#include "sched.h"
+#include "prof.h"
+#include "clock.h"
+#include "timesync.h"
 #include "../lib/mtbbus.h"
 #include "../lib/crc16modbus.h"
 
@@ -27,6 +37,8 @@ void mtbbus_received(bool broadcast, uint8_t command_code, uint8_t *data, uint8_
 static void mtbbus_send_ack(void);
 static void mtbbus_send_inputs(uint8_t message_code);
 static void mtbbus_send_error(uint8_t code);
+static void mtbbus_send_error_index(uint8_t *data, uint8_t data_len, uint8_t count);
+static void mtbbus_send_error_tlv(uint8_t result);
 static inline void leds_update(void);
 void goto_bootloader(void); // intentionally not static
 static inline void update_mtbbus_polarity(void);
@@ -40,6 +52,25 @@ static inline void autodetect_mtbbus_speed_stop(void);
 static void mtbbus_auto_speed_next(void);
 static inline void mtbbus_auto_speed_received(void);
 static void send_diag_value(uint8_t i);
+static void mtbbus_received_specific(bool broadcast, uint8_t code, uint8_t *data, uint8_t data_len);
+static void failover(void);
+static void failover_end(void);
+static inline void idle_sleep(void);
+#ifdef SUP_PROFILING
+static void mtbbus_received_prof(bool broadcast, uint8_t command_code, uint8_t *data, uint8_t data_len);
+static void fill_prof_stats(const prof_stat_t stats[], uint8_t count);
+#endif
+
+static bool task_debounce_ready(void);
+static void task_debounce(void);
+static bool task_failover_ready(void);
+static bool task_tick_ready(void);
+static void task_tick(void);
+static bool task_btn_ready(void);
+static void task_btn(void);
+static bool task_auto_speed_ready(void);
+static bool task_diag_ready(void);
+static void task_diag(void);
 
 ///////////////////////////////////////////////////////////////////////////////
 // Defines & global variables
@@ -61,84 +92,177 @@ bool beacon = false;
 uint8_t led_blue_counter = 0;
 
 volatile bool inputs_debounce_to_update = false;
-bool outputs_changed_when_setting_scom = false;
 
 __attribute__((used, section(".fwattr"))) struct {
 	uint8_t no_pages;
 	uint16_t crc;
 } fwattr;
 
+// Module is initialized as soon as inputs are debounced, LEDs test runs
+// independently.
 bool initialized = false;
-volatile uint8_t _init_counter = 0;
-#define INIT_TIME 50 // 500 ms
-
-#define MTBBUS_TIMEOUT_MAX 100 // 1 s
-volatile uint8_t mtbbus_timeout = MTBBUS_TIMEOUT_MAX; // increment each 10 ms
-
-#define BTN_PRESS_1S 100
-volatile uint8_t btn_press_time = 0;
-
-volatile bool mtbbus_auto_speed_in_progress = false;
-volatile uint8_t mtbbus_auto_speed_timer = 0;
-volatile uint8_t mtbbus_auto_speed_last;
-#define MTBBUS_AUTO_SPEED_TIMEOUT 20 // 200 ms
-
-volatile uint8_t diag_timer = 0;
+bool warm_restart = false; // state was restored after watchdog reset
+#define LED_TEST_TIME 50 // 500 ms
+uint8_t led_test_counter = 0;
+
+uint16_t first_response_ms = 0xFFFF; // time from start to first MTBbus message processed
+
+// Timeouts are deadlines / timestamps in clock ms
+#define MTBBUS_TIMEOUT_MS 1000
+bool mtbbus_received_any = false;
+uint32_t mtbbus_last_received = 0;
+
+bool failover_active = false;
+
+#define BTN_LONG_PRESS_MS 1000
+uint32_t btn_pressed_at = 0;
+bool btn_long_handled = true;
+
+bool mtbbus_auto_speed_in_progress = false;
+uint32_t mtbbus_auto_speed_deadline = 0;
+uint8_t mtbbus_auto_speed_last;
+#define MTBBUS_AUTO_SPEED_TIMEOUT_MS 200
+
+// Module-specific commands (first data byte of MTBBUS_CMD_MOSI_SPECIFIC)
+#define MTBBUS_SPEC_FLICKER_SYNC 0x01
+#define MTBBUS_SPEC_SET_PATTERN 0x02
+#define MTBBUS_SPEC_GET_PATTERN 0x03
+#define MTBBUS_SPEC_APPLY_SCENE 0x04
+#define MTBBUS_SPEC_SET_SCENE 0x05
+#define MTBBUS_SPEC_GET_SCENE 0x06
+#define MTBBUS_SPEC_STAGE_OUTPUT 0x07
+#define MTBBUS_SPEC_COMMIT_OUTPUT 0x08
+#define MTBBUS_SPEC_MULTI_OUTPUT 0x09
+#define MTBBUS_SPEC_SET_RULE 0x0A
+#define MTBBUS_SPEC_GET_RULE 0x0B
+#define MTBBUS_SPEC_RESTORE_OUTPUT 0x0C
+#define MTBBUS_SPEC_TIME_SYNC 0x0D
+#define MTBBUS_SPEC_SET_CONFIG_TLV 0x0E
+#define MTBBUS_SPEC_GET_CONFIG_TLV 0x0F
+#define MTBBUS_SPEC_CONFIG_PUSH 0x10
+#define MTBBUS_SPEC_GET_CONFIG_CRC 0x11
+#define MTBBUS_SPEC_FIRE_PULSE 0x12
+
+#define CONFIG_PUSH_RANGE 0x00
+#define CONFIG_PUSH_BITMAP 0x01
+
+uint32_t diag_deadline = DIAG_UPDATE_PERIOD;
 volatile bool t3_elapsed = false;
 
+// Main loop tasks ordered by priority
+static const sched_task_t tasks[] PROGMEM = {
+	{task_debounce_ready, task_debounce, SCHED_US(500)},
+	{task_failover_ready, failover, SCHED_US(10000)},
+	{task_tick_ready, task_tick, SCHED_US(10000)},
+	{task_btn_ready, task_btn, SCHED_US(10000)},
+	{task_auto_speed_ready, mtbbus_auto_speed_next, SCHED_US(10000)},
+	{task_diag_ready, task_diag, SCHED_US(30000)},
+	{config_commit_ready, config_update, SCHED_NO_DEADLINE},
+};
+#define TASKS_COUNT (sizeof(tasks)/sizeof(*tasks))
+
 ///////////////////////////////////////////////////////////////////////////////
 
 int main() {
 	init();
 
 	while (true) {
-		mtbbus_update();
-
-		if (inputs_debounce_to_update) {
-			inputs_debounce_to_update = false;
-			inputs_debounce_update();
-		}
+		mtbbus_update(); // always first: answer MTBbus within T0
+		sched_update(tasks, TASKS_COUNT);
+		wdt_reset();
+		idle_sleep();
+	}
+}
 
-		if (config_write) {
-			if (config_save()) // repeat calling until all data really saved
-				config_write = false;
-		}
+uint16_t wake_latency_max = 0; // CPU cycles
+uint16_t wake_latency_avg = 0; // CPU cycles
+uint32_t _wake_latency_avg8 = 0; // moving average × 8
 
-		if (btn_press_time == BTN_PRESS_1S) {
-			btn_press_time = 0xFF;
-			btn_long_press();
-		}
+void idle_sleep(void) {
+	// Sleep until next interrupt (timers, USART) when no work is pending.
+	// Flags are checked with interrupts disabled; instruction after 'sei' is
+	// always executed before any interrupt, so no wakeup could be missed.
+	cli();
+	if ((mtbbus_pending()) || (sched_pending(tasks, TASKS_COUNT))) {
+		sei();
+		return;
+	}
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+
+	if (inputs_debounce_to_update) {
+		// Woken by timer 1: it's counter = cycles since compare match (CTC)
+		uint16_t latency;
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { latency = TCNT1; }
+		if (latency > wake_latency_max)
+			wake_latency_max = latency;
+		_wake_latency_avg8 = _wake_latency_avg8 - (_wake_latency_avg8 / 8) + latency;
+		wake_latency_avg = _wake_latency_avg8 / 8;
+	}
+}
 
-		if ((mtbbus_auto_speed_in_progress) && (mtbbus_auto_speed_timer == MTBBUS_AUTO_SPEED_TIMEOUT))
-			mtbbus_auto_speed_next();
+///////////////////////////////////////////////////////////////////////////////
+// Main loop tasks
+
+bool task_debounce_ready(void) { return inputs_debounce_to_update; }
+void task_debounce(void) {
+	static uint16_t inputs_last = 0;
+	inputs_debounce_to_update = false;
+	inputs_debounce_update();
+	if (inputs_logic_state != inputs_last) {
+		inputs_last = inputs_logic_state;
+		if (initialized)
+			rules_update(false);
+	}
+	if ((!initialized) && (inputs_settled()))
+		on_initialized();
+}
 
-		if (diag_timer >= DIAG_UPDATE_PERIOD) {
-			diag_timer = 0;
-			diag_update();
-		}
+bool task_failover_ready(void) {
+	if ((config_failover_timeout == 0) || (!mtbbus_received_any) || (failover_active))
+		return false;
+	return clock_reached(mtbbus_last_received + 50*(uint16_t)config_failover_timeout);
+}
 
-		if (_init_counter == INIT_TIME) {
-			_init_counter = 0xFF;
-			on_initialized();
-		}
+bool task_tick_ready(void) { return t3_elapsed; }
+void task_tick(void) {
+	t3_elapsed = false;
 
-		if (t3_elapsed) {
-			t3_elapsed = false;
+	outputs_update();
+	pwm_update();
+	inputs_fall_update();
+	if (initialized) {
+		rules_update(true);
+		warm_save();
+	}
+	leds_update();
+}
 
-			outputs_update();
-			inputs_fall_update();
-			leds_update();
+bool task_btn_ready(void) {
+	return (btn_pressed) && (!btn_long_handled) && (clock_reached(btn_pressed_at + BTN_LONG_PRESS_MS));
+}
+void task_btn(void) {
+	btn_long_handled = true;
+	btn_long_press();
+}
 
-			outputs_changed_when_setting_scom = false;
-			scom_update();
-			if (outputs_changed_when_setting_scom)
-				outputs_apply_state();
-		}
+bool task_auto_speed_ready(void) {
+	return ((mtbbus_auto_speed_in_progress) && (clock_reached(mtbbus_auto_speed_deadline)));
+}
 
-		wdt_reset();
-	}
+bool task_diag_ready(void) { return clock_reached(diag_deadline); }
+void task_diag(void) {
+	diag_deadline += DIAG_UPDATE_PERIOD;
+	diag_update();
+#ifdef SUP_PROFILING
+	prof_update();
+#endif
 }
 
+///////////////////////////////////////////////////////////////////////////////
+
 void init(void) {
 	cli();
 	wdt_disable();
@@ -147,83 +271,103 @@ void init(void) {
 	mcucsr.all = MCUCSR;
 	MCUCSR = 0;
 
+	config_load();
+
+	// Any watchdog reset (unintended, software reset or goto_bootloader)
+	// → warm restart, warm state itself is checked by it's CRC
+	bool watchdog_reset = (mcucsr.bits.wdrf) && (!mcucsr.bits.porf) &&
+	                      (!mcucsr.bits.borf) && (!mcucsr.bits.extrf);
+	if (!watchdog_reset)
+		warm_invalidate();
 	if (config_is_int_wdrf()) {
-		mcucsr.bits.wdrf = false;
+		mcucsr.bits.wdrf = false; // intended reset is not reported as warning
 		config_int_wdrf(false);
 	}
 	mcucsr.bits.borf = false; // brownout detects basically all power-on resets
+
 	mtbbus_warn_flags.all = (mcucsr.all >> 1) & 0x0F;
 
 	io_init();
-	io_led_red_on();
-	io_led_green_on();
-	io_led_blue_on();
-	scom_init();
 
 	// Setup timer 1 @ 2 kHz (period 500 us)
 	TCCR1B = (1 << WGM12) | (1 << CS10); // CTC mode, no prescaler
 	TIMSK = (1 << OCIE1A); // enable compare match interrupt
 	OCR1A = 7365;
 
-	// Setup timer 3 @ 100 Hz (period 10 ms)
-	TCCR3B = (1 << WGM12) | (1 << CS11) | (1 << CS10); // CTC mode, 64× prescaler
-	ETIMSK = (1 << OCIE3A); // enable compare match interrupt
-	OCR3A = 2302;
+	// Setup timer 3: free-running, channel A @ 100 Hz (period 10 ms), channel B for S-COM
+	TCCR3B = (1 << CS31); // normal mode, 8× prescaler
+	ETIMSK = (1 << OCIE3A) | (1 << OCIE3B); // enable compare match interrupts
+	OCR3A = T3_PERIOD_10MS;
 
-	config_load();
-	outputs_set_full(config_safe_state);
+	encoder_init();
+	pwm_init();
+
+	if (watchdog_reset)
+		warm_restart = warm_restore();
+	if (!warm_restart) {
+		led_test_counter = LED_TEST_TIME;
+		io_led_red_on();
+		io_led_green_on();
+		io_led_blue_on();
+		outputs_set_full(config_safe_state);
+	}
 
 	uint8_t _mtbbus_addr = io_get_addr_raw();
 	error_flags.bits.addr_zero = (_mtbbus_addr == 0);
 	mtbbus_init(_mtbbus_addr, config_mtbbus_speed);
+#ifdef SUP_PROFILING
+	mtbbus_on_receive = mtbbus_received_prof;
+#else
 	mtbbus_on_receive = mtbbus_received;
+#endif
+	outputs_on_master_set = failover_end;
 
 	update_mtbbus_polarity();
 	diag_init();
 
 	mtbbus_warn_flags_old.all = 0xFF; // causes report of change to PC
+	set_sleep_mode(SLEEP_MODE_IDLE); // all timers & USART run in idle sleep
 	wdt_enable(WDTO_250MS);
 	sei(); // enable interrupts globally
 }
 
 void on_initialized(void) {
-	io_led_red_off();
-	io_led_green_off();
-	io_led_blue_off();
 	initialized = true;
 }
 
 ISR(TIMER1_COMPA_vect) {
 	// Timer 1 @ 2 kHz (period 500 us)
+	PROF_ISR_BEGIN();
 	inputs_debounce_to_update = true;
+	PROF_ISR_END(PROF_ISR_TIMER1);
 }
 
 ISR(TIMER3_COMPA_vect) {
 	// Timer 3 @ 100 Hz (period 10 ms)
+	PROF_ISR_BEGIN();
+	OCR3A += T3_PERIOD_10MS;
+
 	if ((TCNT1H > 0) & (TCNT1H < OCR1AH))
 		mtbbus_warn_flags.bits.missed_timer = true;
 
 	t3_elapsed = true;
-
-	if (_init_counter < INIT_TIME)
-		_init_counter++;
-
-	if (mtbbus_timeout < MTBBUS_TIMEOUT_MAX)
-		mtbbus_timeout++;
-
-	if ((btn_pressed) && (btn_press_time < BTN_PRESS_1S))
-		btn_press_time++;
-
-	if ((mtbbus_auto_speed_in_progress) && (mtbbus_auto_speed_timer < MTBBUS_AUTO_SPEED_TIMEOUT))
-		mtbbus_auto_speed_timer++;
-
-	if (diag_timer < DIAG_UPDATE_PERIOD)
-		diag_timer++;
+	clock_tick();
+	PROF_ISR_END(PROF_ISR_TIMER3A);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 
 void leds_update(void) {
+	if (led_test_counter > 0) {
+		led_test_counter--;
+		if (led_test_counter == 0) {
+			io_led_red_off();
+			io_led_green_off();
+			io_led_blue_off();
+		}
+		return;
+	}
+
 	if (led_gr_counter > 0) {
 		led_gr_counter--;
 		if (led_gr_counter == LED_GR_OFF)
@@ -264,12 +408,15 @@ void led_red_ok(void) {
 ///////////////////////////////////////////////////////////////////////////////
 
 void btn_on_pressed(void) {
-	btn_press_time = 0;
+	btn_pressed_at = clock_ms();
+	btn_long_handled = false;
 }
 
 void btn_on_depressed(void) {
-	if (btn_press_time < BTN_PRESS_1S)
+	if (!btn_long_handled) {
+		btn_long_handled = true;
 		btn_short_press();
+	}
 }
 
 void btn_short_press(void) {
@@ -297,6 +444,10 @@ void mtbbus_received(bool broadcast, uint8_t command_code, uint8_t *data, uint8_
 	if (!initialized)
 		return;
 
+	uint32_t now = clock_ms();
+	if (first_response_ms == 0xFFFF)
+		first_response_ms = (now < 0xFFFF) ? now : 0xFFFE;
+
 	error_flags.bits.bad_mtbbus_polarity = false;
 	if (led_gr_counter == 0) {
 		io_led_green_on();
@@ -304,7 +455,8 @@ void mtbbus_received(bool broadcast, uint8_t command_code, uint8_t *data, uint8_
 	}
 	_delay_us(2);
 
-	mtbbus_timeout = 0;
+	mtbbus_last_received = now;
+	mtbbus_received_any = true;
 	if (mtbbus_auto_speed_in_progress)
 		mtbbus_auto_speed_received();
 
@@ -358,16 +510,39 @@ void mtbbus_received(bool broadcast, uint8_t command_code, uint8_t *data, uint8_
 			mtbbus_send_ack();
 			memcpy((uint8_t*)config_safe_state, data, NO_OUTPUTS);
 			memcpy((uint8_t*)config_inputs_delay, data+NO_OUTPUTS, NO_INPUTS/2);
-			config_write = true;
+			if (data_len >= 25)
+				config_scom_flags = data[24];
+			if (data_len >= 27) {
+				config_scom_period = data[25];
+				config_scom_gap = data[26];
+				config_scom_check();
+				encoder_apply_config();
+			}
+			if (data_len >= 28)
+				config_pwm_fade = data[27];
+			if ((data_len >= 29) && (data[28] <= CONFIG_FAILOVER_TIMEOUT_MAX))
+				config_failover_timeout = data[28];
+			config_changed(config_safe_state, sizeof(config_safe_state));
+			config_changed(config_inputs_delay, sizeof(config_inputs_delay));
+			config_changed(&config_scom_flags, 1);
+			config_changed(&config_scom_period, 1);
+			config_changed(&config_scom_gap, 1);
+			config_changed(&config_pwm_fade, 1);
+			config_changed(&config_failover_timeout, 1);
 		} else { goto INVALID_MSG; }
 		break;
 
 	case MTBBUS_CMD_MOSI_GET_CONFIG:
 		if (!broadcast) {
-			mtbbus_output_buf[0] = 25;
+			mtbbus_output_buf[0] = 30;
 			mtbbus_output_buf[1] = MTBBUS_CMD_MISO_MODULE_CONFIG;
 			memcpy((uint8_t*)mtbbus_output_buf+2, config_safe_state, NO_OUTPUTS);
 			memcpy((uint8_t*)mtbbus_output_buf+2+NO_OUTPUTS, config_inputs_delay, NO_INPUTS/2);
+			mtbbus_output_buf[26] = config_scom_flags;
+			mtbbus_output_buf[27] = config_scom_period;
+			mtbbus_output_buf[28] = config_scom_gap;
+			mtbbus_output_buf[29] = config_pwm_fade;
+			mtbbus_output_buf[30] = config_failover_timeout;
 			mtbbus_send_buf_autolen();
 		} else { goto INVALID_MSG; }
 		break;
@@ -396,14 +571,13 @@ void mtbbus_received(bool broadcast, uint8_t command_code, uint8_t *data, uint8_
 			mtbbus_send_buf_autolen();
 
 			outputs_set_zipped(data, data_len);
-			outputs_changed_when_setting_scom = true;
 		} else { goto INVALID_MSG; }
 		break;
 
 	case MTBBUS_CMD_MOSI_RESET_OUTPUTS:
 		if (!broadcast)
 			mtbbus_send_ack();
-		outputs_set_full(config_safe_state);
+		outputs_set_masked(0xFFFF, config_safe_state); // set by master → ends failover
 		break;
 
 	case MTBBUS_CMD_MOSI_CHANGE_ADDR:
@@ -415,7 +589,7 @@ void mtbbus_received(bool broadcast, uint8_t command_code, uint8_t *data, uint8_
 	case MTBBUS_CMD_MOSI_CHANGE_SPEED:
 		if (data_len >= 1) {
 			config_mtbbus_speed = data[0];
-			config_write = true;
+			config_changed(&config_mtbbus_speed, 1);
 			mtbbus_set_speed(data[0]);
 
 			if (!broadcast)
@@ -425,7 +599,7 @@ void mtbbus_received(bool broadcast, uint8_t command_code, uint8_t *data, uint8_
 
 	case MTBBUS_CMD_MOSI_FWUPGD_REQUEST:
 		if ((data_len >= 1) && (!broadcast)) {
-			config_boot_fwupgd();
+			config_boot_fwupgd(); // written in background, flushed in goto_bootloader
 			mtbbus_on_sent = &goto_bootloader;
 			mtbbus_send_ack();
 		} else { goto INVALID_MSG; }
@@ -446,6 +620,12 @@ void mtbbus_received(bool broadcast, uint8_t command_code, uint8_t *data, uint8_
 		} else { goto INVALID_MSG; }
 		break;
 
+	case MTBBUS_CMD_MOSI_SPECIFIC:
+		if (data_len >= 1) {
+			mtbbus_received_specific(broadcast, data[0], data+1, data_len-1);
+		} else { goto INVALID_MSG; }
+		break;
+
 INVALID_MSG:
 	default:
 		if (!broadcast)
@@ -454,6 +634,304 @@ INVALID_MSG:
 	};
 }
 
+void mtbbus_received_specific(bool broadcast, uint8_t code, uint8_t *data, uint8_t data_len) {
+	switch (code) {
+
+	case MTBBUS_SPEC_FLICKER_SYNC:
+		// Usually broadcast: all modules start flickering in same phase
+		clock_align(); // align 10 ms period too
+		outputs_flicker_sync();
+		if (!broadcast)
+			mtbbus_send_ack();
+		break;
+
+	case MTBBUS_SPEC_TIME_SYNC:
+		// Usually broadcast: master's time in ms
+		if (data_len >= 4) {
+			timesync_received(((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+			                  ((uint32_t)data[2] << 8) | data[3]);
+			if (!broadcast)
+				mtbbus_send_ack();
+		} else if (!broadcast) {
+			mtbbus_send_error(MTBBUS_ERROR_UNKNOWN_COMMAND);
+		}
+		break;
+
+	case MTBBUS_SPEC_SET_PATTERN:
+		// Period 0xFF is reserved (not saved by older firmware)
+		if ((data_len >= 1+sizeof(config_pattern_t)) && (data[0] < CONFIG_PATTERNS) &&
+		    (data[sizeof(config_pattern_t)] > 0) && (data[sizeof(config_pattern_t)] != 0xFF)) {
+			config_patterns[data[0]].steps = ((uint32_t)data[1] << 24) | ((uint32_t)data[2] << 16) |
+			                                 ((uint32_t)data[3] << 8) | data[4];
+			config_patterns[data[0]].period = data[5];
+			config_changed(&config_patterns[data[0]], sizeof(config_pattern_t));
+			if (!broadcast)
+				mtbbus_send_ack();
+		} else if (!broadcast) {
+			mtbbus_send_error_index(data, data_len, CONFIG_PATTERNS);
+		}
+		break;
+
+	case MTBBUS_SPEC_GET_PATTERN:
+		if ((!broadcast) && (data_len >= 1) && (data[0] < CONFIG_PATTERNS)) {
+			mtbbus_output_buf[0] = 3+sizeof(config_pattern_t);
+			mtbbus_output_buf[1] = MTBBUS_CMD_MISO_SPECIFIC;
+			mtbbus_output_buf[2] = MTBBUS_SPEC_GET_PATTERN;
+			mtbbus_output_buf[3] = data[0];
+			mtbbus_output_buf[4] = config_patterns[data[0]].steps >> 24;
+			mtbbus_output_buf[5] = (config_patterns[data[0]].steps >> 16) & 0xFF;
+			mtbbus_output_buf[6] = (config_patterns[data[0]].steps >> 8) & 0xFF;
+			mtbbus_output_buf[7] = config_patterns[data[0]].steps & 0xFF;
+			mtbbus_output_buf[8] = config_patterns[data[0]].period;
+			mtbbus_send_buf_autolen();
+		} else if (!broadcast) {
+			mtbbus_send_error_index(data, data_len, CONFIG_PATTERNS);
+		}
+		break;
+
+	case MTBBUS_SPEC_APPLY_SCENE:
+		if ((data_len >= 1) && (data[0] < CONFIG_SCENES)) {
+			if (!broadcast)
+				mtbbus_send_ack(); // send response first, setting of outputs takes some time
+			outputs_set_masked(config_scenes[data[0]].mask, config_scenes[data[0]].states);
+		} else if (!broadcast) {
+			mtbbus_send_error_index(data, data_len, CONFIG_SCENES);
+		}
+		break;
+
+	case MTBBUS_SPEC_SET_SCENE:
+		if ((data_len >= 3+NO_OUTPUTS) && (data[0] < CONFIG_SCENES)) {
+			config_scenes[data[0]].mask = (data[1] << 8) | data[2];
+			memcpy(config_scenes[data[0]].states, data+3, NO_OUTPUTS);
+			config_changed(&config_scenes[data[0]], sizeof(config_scene_t));
+			if (!broadcast)
+				mtbbus_send_ack();
+		} else if (!broadcast) {
+			mtbbus_send_error_index(data, data_len, CONFIG_SCENES);
+		}
+		break;
+
+	case MTBBUS_SPEC_GET_SCENE:
+		if ((!broadcast) && (data_len >= 1) && (data[0] < CONFIG_SCENES)) {
+			mtbbus_output_buf[0] = 5+NO_OUTPUTS;
+			mtbbus_output_buf[1] = MTBBUS_CMD_MISO_SPECIFIC;
+			mtbbus_output_buf[2] = MTBBUS_SPEC_GET_SCENE;
+			mtbbus_output_buf[3] = data[0];
+			mtbbus_output_buf[4] = config_scenes[data[0]].mask >> 8;
+			mtbbus_output_buf[5] = config_scenes[data[0]].mask & 0xFF;
+			memcpy((uint8_t*)mtbbus_output_buf+6, config_scenes[data[0]].states, NO_OUTPUTS);
+			mtbbus_send_buf_autolen();
+		} else if (!broadcast) {
+			mtbbus_send_error_index(data, data_len, CONFIG_SCENES);
+		}
+		break;
+
+	case MTBBUS_SPEC_STAGE_OUTPUT:
+		// Same data as MTBBUS_CMD_MOSI_SET_OUTPUT, applied on MTBBUS_SPEC_COMMIT_OUTPUT
+		if ((data_len >= 4) && (!broadcast)) {
+			outputs_stage_zipped(data, data_len);
+			mtbbus_send_ack();
+		} else if (!broadcast) {
+			mtbbus_send_error(MTBBUS_ERROR_UNKNOWN_COMMAND);
+		}
+		break;
+
+	case MTBBUS_SPEC_COMMIT_OUTPUT:
+		// Usually broadcast: all modules apply staged outputs in same time
+		if (!broadcast)
+			mtbbus_send_ack();
+		outputs_commit_staged();
+		break;
+
+	case MTBBUS_SPEC_FIRE_PULSE:
+		// Repeat pulse on outputs (mask, big-endian) already in pulse state
+		if (data_len >= 2) {
+			if (!broadcast)
+				mtbbus_send_ack();
+			outputs_fire_pulses((data[0] << 8) | data[1]);
+		} else if (!broadcast) {
+			mtbbus_send_error(MTBBUS_ERROR_UNKNOWN_COMMAND);
+		}
+		break;
+
+	case MTBBUS_SPEC_MULTI_OUTPUT:
+		// Broadcast only: list of records (address, length, zipped outputs),
+		// no response. Parsed directly from input buffer.
+		if (broadcast) {
+			uint8_t i = 0;
+			while (i+2 <= data_len) {
+				uint8_t addr = data[i];
+				uint8_t len = data[i+1];
+				if (i+2+len > data_len)
+					break; // malformed record
+				if (addr == mtbbus_addr) {
+					outputs_set_zipped(data+i+2, len);
+					break;
+				}
+				i += 2+len;
+			}
+		} else {
+			mtbbus_send_error(MTBBUS_ERROR_UNKNOWN_COMMAND);
+		}
+		break;
+
+	case MTBBUS_SPEC_SET_RULE:
+		if ((data_len >= 1+sizeof(config_rule_t)) && (data[0] < CONFIG_RULES)) {
+			config_rule_t* rule = &config_rules[data[0]];
+			rule->on = ((uint32_t)data[1] << 24) | ((uint32_t)data[2] << 16) |
+			           ((uint32_t)data[3] << 8) | data[4];
+			rule->off = ((uint32_t)data[5] << 24) | ((uint32_t)data[6] << 16) |
+			            ((uint32_t)data[7] << 8) | data[8];
+			rule->output = data[9];
+			rule->state_true = data[10];
+			rule->state_false = data[11];
+			rule->delay = data[12];
+			config_changed(rule, sizeof(config_rule_t));
+			if (!broadcast)
+				mtbbus_send_ack();
+		} else if (!broadcast) {
+			mtbbus_send_error_index(data, data_len, CONFIG_RULES);
+		}
+		break;
+
+	case MTBBUS_SPEC_GET_RULE:
+		if ((!broadcast) && (data_len >= 1) && (data[0] < CONFIG_RULES)) {
+			mtbbus_output_buf[0] = 3+sizeof(config_rule_t);
+			mtbbus_output_buf[1] = MTBBUS_CMD_MISO_SPECIFIC;
+			mtbbus_output_buf[2] = MTBBUS_SPEC_GET_RULE;
+			mtbbus_output_buf[3] = data[0];
+			const config_rule_t* rule = &config_rules[data[0]];
+			mtbbus_output_buf[4] = rule->on >> 24;
+			mtbbus_output_buf[5] = (rule->on >> 16) & 0xFF;
+			mtbbus_output_buf[6] = (rule->on >> 8) & 0xFF;
+			mtbbus_output_buf[7] = rule->on & 0xFF;
+			mtbbus_output_buf[8] = rule->off >> 24;
+			mtbbus_output_buf[9] = (rule->off >> 16) & 0xFF;
+			mtbbus_output_buf[10] = (rule->off >> 8) & 0xFF;
+			mtbbus_output_buf[11] = rule->off & 0xFF;
+			mtbbus_output_buf[12] = rule->output;
+			mtbbus_output_buf[13] = rule->state_true;
+			mtbbus_output_buf[14] = rule->state_false;
+			mtbbus_output_buf[15] = rule->delay;
+			mtbbus_send_buf_autolen();
+		} else if (!broadcast) {
+			mtbbus_send_error_index(data, data_len, CONFIG_RULES);
+		}
+		break;
+
+	case MTBBUS_SPEC_SET_CONFIG_TLV: {
+		// Records (tag, length, value), see config.h
+		uint8_t result = config_tlv_set(data, data_len);
+		if (result == CONFIG_TLV_OK) {
+			encoder_apply_config();
+			if (!broadcast)
+				mtbbus_send_ack();
+		} else if (!broadcast) {
+			mtbbus_send_error_tlv(result);
+		}
+		break;
+	}
+
+	case MTBBUS_SPEC_GET_CONFIG_TLV:
+		// Request: list of tags, response: format version & records
+		if ((!broadcast) && (data_len >= 1)) {
+			uint8_t len = 4;
+			for (uint8_t i = 0; i < data_len; i++) {
+				uint8_t rec;
+				uint8_t result = config_tlv_get(data[i], (uint8_t*)mtbbus_output_buf+len,
+				                                MTBBUS_OUTPUT_BUF_MAX_SIZE_USER-len, &rec);
+				if (result != CONFIG_TLV_OK) {
+					mtbbus_send_error_tlv(result);
+					return;
+				}
+				len += rec;
+			}
+			mtbbus_output_buf[0] = len-1;
+			mtbbus_output_buf[1] = MTBBUS_CMD_MISO_SPECIFIC;
+			mtbbus_output_buf[2] = MTBBUS_SPEC_GET_CONFIG_TLV;
+			mtbbus_output_buf[3] = CONFIG_FORMAT_VERSION;
+			mtbbus_send_buf_autolen();
+		} else if (!broadcast) {
+			mtbbus_send_error(MTBBUS_ERROR_UNKNOWN_COMMAND);
+		}
+		break;
+
+	case MTBBUS_SPEC_CONFIG_PUSH:
+		// Usually broadcast: filter of addresses, CRC of records & records
+		// as in MTBBUS_SPEC_SET_CONFIG_TLV. Filter is (CONFIG_PUSH_RANGE,
+		// first, last) or (CONFIG_PUSH_BITMAP, first, length, bitmap); bit i
+		// of bitmap byte j = address first+8*j+i.
+		if (data_len >= 3) {
+			uint8_t i;
+			bool selected;
+			if (data[0] == CONFIG_PUSH_RANGE) {
+				selected = (mtbbus_addr >= data[1]) && (mtbbus_addr <= data[2]);
+				i = 3;
+			} else if (data[0] == CONFIG_PUSH_BITMAP) {
+				uint8_t bit = mtbbus_addr - data[1];
+				selected = (mtbbus_addr >= data[1]) && (bit/8 < data[2]) && (3+data[2] <= data_len) &&
+				           ((data[3+bit/8] >> (bit%8)) & 1);
+				i = 3+data[2];
+			} else {
+				selected = false;
+				i = data_len;
+			}
+
+			if (!selected) {
+				if (!broadcast)
+					mtbbus_send_error(MTBBUS_ERROR_BAD_ADDRESS);
+			} else if ((i+2 > data_len) ||
+			           (crc16modbus_bytes(0, data+i+2, data_len-i-2) != ((data[i] << 8) | data[i+1]))) {
+				if (!broadcast)
+					mtbbus_send_error(MTBBUS_ERROR_UNKNOWN_COMMAND);
+			} else {
+				uint8_t result = config_tlv_set(data+i+2, data_len-i-2);
+				if (result == CONFIG_TLV_OK) {
+					encoder_apply_config();
+					if (!broadcast)
+						mtbbus_send_ack();
+				} else if (!broadcast) {
+					mtbbus_send_error_tlv(result);
+				}
+			}
+		} else if (!broadcast) {
+			mtbbus_send_error(MTBBUS_ERROR_UNKNOWN_COMMAND);
+		}
+		break;
+
+	case MTBBUS_SPEC_GET_CONFIG_CRC:
+		// Fast verification of configuration: format version, CRC of whole
+		// tagged configuration (see config_crc) & saving in progress flag
+		// (CRC is of previous configuration until saving finishes)
+		if (!broadcast) {
+			uint16_t crc = config_crc();
+			mtbbus_output_buf[0] = 6;
+			mtbbus_output_buf[1] = MTBBUS_CMD_MISO_SPECIFIC;
+			mtbbus_output_buf[2] = MTBBUS_SPEC_GET_CONFIG_CRC;
+			mtbbus_output_buf[3] = CONFIG_FORMAT_VERSION;
+			mtbbus_output_buf[4] = crc >> 8;
+			mtbbus_output_buf[5] = crc & 0xFF;
+			mtbbus_output_buf[6] = config_pending();
+			mtbbus_send_buf_autolen();
+		}
+		break;
+
+	case MTBBUS_SPEC_RESTORE_OUTPUT:
+		// Restore outputs state from before communication loss
+		if (!broadcast)
+			mtbbus_send_ack();
+		if (failover_active) {
+			failover_end();
+			outputs_restore();
+		}
+		break;
+
+	default:
+		if (!broadcast)
+			mtbbus_send_error(MTBBUS_ERROR_UNKNOWN_COMMAND);
+	};
+}
+
 // Warning: functions below don't check mtbbus_can_fill_output_buf(), bacause
 // they should be called ONLY from mtbbus_received event (as MTBbus is
 // request-response based bus).
@@ -479,10 +957,29 @@ void mtbbus_send_error(uint8_t code) {
 	mtbbus_send_buf_autolen();
 }
 
+// Error of command addressing item by index in data[0]: bad index → bad
+// address, anything else (length, invalid value) → unknown command.
+void mtbbus_send_error_index(uint8_t *data, uint8_t data_len, uint8_t count) {
+	if ((data_len >= 1) && (data[0] >= count))
+		mtbbus_send_error(MTBBUS_ERROR_BAD_ADDRESS);
+	else
+		mtbbus_send_error(MTBBUS_ERROR_UNKNOWN_COMMAND);
+}
+
+// Error of tagged config command: unknown tag → bad address, malformed
+// records → unknown command.
+void mtbbus_send_error_tlv(uint8_t result) {
+	if (result == CONFIG_TLV_UNKNOWN_TAG)
+		mtbbus_send_error(MTBBUS_ERROR_BAD_ADDRESS);
+	else
+		mtbbus_send_error(MTBBUS_ERROR_UNKNOWN_COMMAND);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 void goto_bootloader(void) {
 	config_int_wdrf(true);
+	config_flush(); // everything must be written before reset
 	wdt_enable(WDTO_15MS);
 	while (true);
 }
@@ -494,7 +991,22 @@ static inline void update_mtbbus_polarity(void) {
 ///////////////////////////////////////////////////////////////////////////////
 
 static inline bool mtbbus_addressed(void) {
-	return mtbbus_timeout < MTBBUS_TIMEOUT_MAX;
+	return (mtbbus_received_any) && (!clock_reached(mtbbus_last_received + MTBBUS_TIMEOUT_MS));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void failover(void) {
+	// No MTBbus communication for configured time → safe state
+	failover_active = true;
+	outputs_backup();
+	outputs_set_full(config_safe_state);
+	mtbbus_warn_flags.bits.comm_lost = true;
+}
+
+void failover_end(void) {
+	failover_active = false;
+	mtbbus_warn_flags.bits.comm_lost = false;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -507,7 +1019,7 @@ void autodetect_mtbbus_speed(void) {
 }
 
 void mtbbus_auto_speed_next(void) {
-	mtbbus_auto_speed_timer = 0;
+	mtbbus_auto_speed_deadline = clock_ms() + MTBBUS_AUTO_SPEED_TIMEOUT_MS;
 	mtbbus_auto_speed_last++; // relies on continuous interval of speeds
 	if (mtbbus_auto_speed_last > MTBBUS_SPEED_MAX)
 		mtbbus_auto_speed_last = MTBBUS_SPEED_38400;
@@ -517,7 +1029,7 @@ void mtbbus_auto_speed_next(void) {
 void mtbbus_auto_speed_received(void) {
 	mtbbus_auto_speed_in_progress = false;
 	config_mtbbus_speed = mtbbus_speed;
-	config_write = true;
+	config_changed(&config_mtbbus_speed, 1);
 	io_led_blue_off();
 }
 
@@ -582,6 +1094,84 @@ void send_diag_value(uint8_t i) {
 		MEMCPY_FROM_VAR(&mtbbus_output_buf[3], mtbbus_diag.unsent);
 		break;
 
+	case MTBBUS_DV_FIRST_RESPONSE:
+		mtbbus_output_buf[0] = 2+2;
+		mtbbus_output_buf[3] = first_response_ms >> 8;
+		mtbbus_output_buf[4] = first_response_ms & 0xFF;
+		break;
+
+#ifdef SUP_PROFILING
+	case MTBBUS_DV_PROF_TASKS:
+		// scheduler tasks in order of priority, last = mtbbus_received
+		fill_prof_stats(prof_tasks, PROF_TASKS);
+		break;
+
+	case MTBBUS_DV_PROF_ISRS:
+		fill_prof_stats(prof_isrs, PROF_ISRS);
+		break;
+
+	case MTBBUS_DV_CPU_LOAD:
+		mtbbus_output_buf[0] = 2+2;
+		mtbbus_output_buf[3] = prof_cpu_load;
+		mtbbus_output_buf[4] = prof_cpu_load_max;
+		break;
+#endif
+
+	case MTBBUS_DV_RAM: {
+		uint16_t static_size = ram_static_size();
+		mtbbus_output_buf[0] = 2+4;
+		mtbbus_output_buf[3] = static_size >> 8;
+		mtbbus_output_buf[4] = static_size & 0xFF;
+		mtbbus_output_buf[5] = ram_free_min >> 8;
+		mtbbus_output_buf[6] = ram_free_min & 0xFF;
+		break;
+	}
+
+	case MTBBUS_DV_WAKE_LATENCY:
+		mtbbus_output_buf[0] = 2+4;
+		mtbbus_output_buf[3] = wake_latency_max >> 8;
+		mtbbus_output_buf[4] = wake_latency_max & 0xFF;
+		mtbbus_output_buf[5] = wake_latency_avg >> 8;
+		mtbbus_output_buf[6] = wake_latency_avg & 0xFF;
+		break;
+
+	case MTBBUS_DV_CLOCK: {
+		uint16_t us;
+		uint32_t ms = clock_read(&us);
+		mtbbus_output_buf[0] = 2+6;
+		mtbbus_output_buf[3] = ms >> 24;
+		mtbbus_output_buf[4] = (ms >> 16) & 0xFF;
+		mtbbus_output_buf[5] = (ms >> 8) & 0xFF;
+		mtbbus_output_buf[6] = ms & 0xFF;
+		mtbbus_output_buf[7] = us >> 8;
+		mtbbus_output_buf[8] = us & 0xFF;
+		break;
+	}
+
+	case MTBBUS_DV_SYNC_TIME: {
+		uint16_t us;
+		uint32_t ms = timesync_ms(&us);
+		mtbbus_output_buf[0] = 2+9;
+		mtbbus_output_buf[3] = timesync_synced | (timesync_drift_valid << 1);
+		mtbbus_output_buf[4] = ms >> 24;
+		mtbbus_output_buf[5] = (ms >> 16) & 0xFF;
+		mtbbus_output_buf[6] = (ms >> 8) & 0xFF;
+		mtbbus_output_buf[7] = ms & 0xFF;
+		mtbbus_output_buf[8] = us >> 8;
+		mtbbus_output_buf[9] = us & 0xFF;
+		mtbbus_output_buf[10] = (uint16_t)timesync_drift >> 8;
+		mtbbus_output_buf[11] = (uint16_t)timesync_drift & 0xFF;
+		break;
+	}
+
+	case MTBBUS_DV_SCHED_OVERRUNS:
+		mtbbus_output_buf[0] = 2+2*TASKS_COUNT;
+		for (uint8_t j = 0; j < TASKS_COUNT; j++) {
+			mtbbus_output_buf[3+2*j] = sched_overruns[j] >> 8;
+			mtbbus_output_buf[4+2*j] = sched_overruns[j] & 0xFF;
+		}
+		break;
+
 	default:
 		mtbbus_output_buf[0] = 2+0;
 		mtbbus_warn_flags_old = mtbbus_warn_flags;
@@ -591,3 +1181,26 @@ void send_diag_value(uint8_t i) {
 }
 
 ///////////////////////////////////////////////////////////////////////////////
+
+#ifdef SUP_PROFILING
+
+void mtbbus_received_prof(bool broadcast, uint8_t command_code, uint8_t *data, uint8_t data_len) {
+	prof_mark_t mark = prof_begin();
+	mtbbus_received(broadcast, command_code, data, data_len);
+	prof_end(PROF_MTBBUS_RECEIVED, mark);
+}
+
+void fill_prof_stats(const prof_stat_t stats[], uint8_t count) {
+	// For each item: max, average (Timer 3 ticks = 8 CPU cycles)
+	mtbbus_output_buf[0] = 2+4*count;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		for (uint8_t i = 0; i < count; i++) {
+			mtbbus_output_buf[3+4*i] = stats[i].max >> 8;
+			mtbbus_output_buf[4+4*i] = stats[i].max & 0xFF;
+			mtbbus_output_buf[5+4*i] = stats[i].avg >> 8;
+			mtbbus_output_buf[6+4*i] = stats[i].avg & 0xFF;
+		}
+	}
+}
+
+#endif
@@ -2,9 +2,11 @@
 #include <string.h>
 #include "outputs.h"
 #include "io.h"
-#include "scom.h"
+#include "encoder.h"
+#include "pwm.h"
+#include "config.h"
 
-const uint8_t _flicker_periods[] = { // in times of calls to outputs_update (10 ms)
+const uint8_t _flicker_periods[OUTPUTS_FLICKER_TYPES] = { // in times of calls to outputs_update (10 ms)
 	10, // invalid
 	50, // 1 Hz
 	25, // 2 Hz
@@ -16,40 +18,105 @@ const uint8_t _flicker_periods[] = { // in times of calls to outputs_update (10
 	50, // 66 tick / min
 };
 
-// Each output has it's flickering counter to avoid neccessity for single
-// lowest-common-multiplier counter (LCM is too big)
-uint8_t _flicker_counters[NO_OUTPUTS] = {0, };
-bool _flicker_enabled[NO_OUTPUTS] = {false, };
+// Each flicker type has single phase counter shared by all outputs (even on
+// different modules after sync), so outputs with same type flicker in phase.
+uint8_t _flicker_phases[OUTPUTS_FLICKER_TYPES] = {0, };
+uint16_t _flicker_outputs[OUTPUTS_FLICKER_TYPES] = {0, }; // outputs flickering with type
+
+// Blink patterns from config: each pattern has single step counter, outputs
+// use pattern with offset of 0, 1/4, 1/2 or 3/4 of pattern length.
+#define PATTERN_OFFSETS 4
+uint8_t _pattern_steps[CONFIG_PATTERNS] = {0, };
+uint8_t _pattern_dividers[CONFIG_PATTERNS] = {0, };
+uint16_t _pattern_outputs[CONFIG_PATTERNS][PATTERN_OFFSETS] = {{0, }, };
+
+// Pulse outputs: pulse is started when output's state changes to pulse
+// state, so re-sending same state (SET_OUTPUT carries all outputs) does not
+// start a new pulse. Same pulse is repeated by outputs_fire_pulses.
+uint8_t _pulse_counters[NO_OUTPUTS] = {0, }; // remaining 10 ms periods of pulse
+uint8_t _pulse_states[NO_OUTPUTS] = {0, }; // state which started the pulse
+uint16_t _pulse_outputs = 0;
+
+// Zipped state waiting for commit
+#define STAGED_MAX_SIZE (4+NO_OUTPUTS)
+uint8_t _staged[STAGED_MAX_SIZE];
+uint8_t _staged_length = 0; // 0 = nothing staged
 
 // State according to ‹protocol›
 // ‹https://github.com/kmzbrnoI/mtbbus-protocol/blob/master/modules/uni.md›
 uint8_t _outputs_state[NO_OUTPUTS] = {0, };
+uint16_t outputs_active = 0;
+uint8_t _outputs_backup[NO_OUTPUTS] = {0, };
+
+void (*outputs_on_master_set)(void) = NULL;
 
 void outputs_apply_state(void) {
 	uint16_t plain_mask = 0;
 	uint16_t plain_state = 0;
+	uint16_t active = 0;
+	uint16_t flicker_outputs[OUTPUTS_FLICKER_TYPES] = {0, };
+	uint16_t pattern_outputs[CONFIG_PATTERNS][PATTERN_OFFSETS] = {{0, }, };
 
 	for (int i = NO_OUTPUTS-1; i >= 0; i--) {
 		plain_mask <<= 1;
 		plain_state <<= 1;
+		active <<= 1;
 
-		_flicker_enabled[i] = ((_outputs_state[i] & 0xC0) == 0x40) ? true : false;
-		if (!_flicker_enabled[i])
-			_flicker_counters[i] = 0;
+		if (_outputs_state[i] != 0)
+			active |= 1;
 
-		if ((_outputs_state[i] & 0x80) == 0)
-			scom_disable_output(i);
+		if ((_outputs_state[i] & 0xF0) == 0x40) { // flicker
+			uint8_t flicker_type = _outputs_state[i] & 0x0F;
+			if (flicker_type >= OUTPUTS_FLICKER_TYPES)
+				flicker_type = 0; // error: unknown flicker period → default flicker period
+			flicker_outputs[flicker_type] |= (1 << i);
+		} else if ((_outputs_state[i] & 0xE0) == 0x60) { // pattern
+			pattern_outputs[_outputs_state[i] & 0x07][(_outputs_state[i] >> 3) & 0x03] |= (1 << i);
+		}
 
 		if (_outputs_state[i] & 0x80) { // S-COM
-			scom_output(i, _outputs_state[i] & 0x7F);
-		} else if ((_outputs_state[i] & 0x40) == 0) { // plain output
+			encoder_output(i, ENC_SCOM, _outputs_state[i] & 0x7F);
+		} else if ((_outputs_state[i] & 0xF0) == 0x50) { // pulse-train code
+			encoder_output(i, ENC_PULSES, _outputs_state[i] & 0x0F);
+		} else {
+			encoder_disable_output(i);
+		}
+
+		if ((_outputs_state[i] & 0xE0) == 0x20) // dimmed output
+			pwm_output(i, _outputs_state[i] & 0x1F);
+		else if ((_outputs_state[i] & 0xFE) == 0) // plain output
+			pwm_fade_out(i, _outputs_state[i] & 1);
+		else
+			pwm_disable_output(i);
+
+		if (_outputs_state[i] >= OUTPUTS_PULSE_MIN && _outputs_state[i] <= OUTPUTS_PULSE_MAX) { // pulse
+			if (_outputs_state[i] != _pulse_states[i]) {
+				_pulse_states[i] = _outputs_state[i];
+				_pulse_counters[i] = _outputs_state[i] * OUTPUTS_PULSE_UNIT;
+			}
+			plain_mask |= 1;
+			if (_pulse_counters[i] > 0) {
+				plain_state |= 1;
+				_pulse_outputs |= (1 << i);
+			}
+		} else {
+			_pulse_states[i] = 0;
+			_pulse_counters[i] = 0;
+			_pulse_outputs &= ~(1 << i);
+		}
+
+		if ((_outputs_state[i] & 0xFE) == 0) { // plain output
 			plain_mask |= 1;
 			if (_outputs_state[i] & 1)
 				plain_state |= 1;
 		}
 	}
 
-	io_set_outputs_raw_mask(plain_state, plain_mask);
+	outputs_active = active;
+	memcpy(_flicker_outputs, flicker_outputs, sizeof(flicker_outputs));
+	memcpy(_pattern_outputs, pattern_outputs, sizeof(pattern_outputs));
+	pwm_apply();
+	io_set_outputs_raw_mask(plain_state, plain_mask & ~pwm_releasing());
 }
 
 void outputs_set_zipped(uint8_t data[], size_t length) {
@@ -59,6 +126,8 @@ void outputs_set_zipped(uint8_t data[], size_t length) {
 	uint16_t full_mask = data[1] | (data[0] << 8);
 	uint16_t bin_state = data[3] | (data[2] << 8);
 	size_t bytei = 4;
+	if (outputs_on_master_set != NULL)
+		outputs_on_master_set();
 
 	for (size_t i = 0; i < NO_OUTPUTS; i++) {
 		if ((full_mask & 1) == 0) {
@@ -77,25 +146,133 @@ void outputs_set_zipped(uint8_t data[], size_t length) {
 	outputs_apply_state();
 }
 
+void outputs_stage_zipped(uint8_t data[], size_t length) {
+	if (length < 4)
+		return;
+	if (length > STAGED_MAX_SIZE)
+		length = STAGED_MAX_SIZE;
+	memcpy(_staged, data, length);
+	_staged_length = length;
+}
+
+bool outputs_commit_staged(void) {
+	if (_staged_length == 0)
+		return false;
+	outputs_set_zipped(_staged, _staged_length);
+	_staged_length = 0;
+	return true;
+}
+
+void outputs_set_masked(uint16_t mask, const uint8_t states[NO_OUTPUTS]) {
+	if (outputs_on_master_set != NULL)
+		outputs_on_master_set();
+	for (size_t i = 0; i < NO_OUTPUTS; i++) {
+		if (mask & 1)
+			_outputs_state[i] = states[i];
+		mask >>= 1;
+	}
+	outputs_apply_state();
+}
+
+void outputs_set_single(uint8_t output, uint8_t state) {
+	if (output >= NO_OUTPUTS)
+		return;
+	_outputs_state[output] = state;
+	outputs_apply_state();
+}
+
 void outputs_set_full(uint8_t data[NO_OUTPUTS]) {
 	memcpy((uint8_t*)_outputs_state, (uint8_t*)data, NO_OUTPUTS);
 	outputs_apply_state();
 }
 
+void outputs_fire_pulses(uint16_t mask) {
+	if (outputs_on_master_set != NULL)
+		outputs_on_master_set();
+	for (size_t i = 0; i < NO_OUTPUTS; i++)
+		if ((mask & (1 << i)) && (_outputs_state[i] >= OUTPUTS_PULSE_MIN) && (_outputs_state[i] <= OUTPUTS_PULSE_MAX))
+			_pulse_states[i] = 0; // pulse started again in outputs_apply_state
+	outputs_apply_state();
+}
+
+void outputs_backup(void) {
+	memcpy(_outputs_backup, _outputs_state, NO_OUTPUTS);
+}
+
+void outputs_restore(void) {
+	// Pulses from before communication loss are not fired again
+	memcpy(_outputs_state, _outputs_backup, NO_OUTPUTS);
+	memcpy(_pulse_states, _outputs_backup, NO_OUTPUTS);
+	outputs_apply_state();
+}
+
+void outputs_warm_save(uint8_t state[NO_OUTPUTS], uint8_t phases[OUTPUTS_PHASES]) {
+	memcpy(state, _outputs_state, NO_OUTPUTS);
+	memcpy(phases, _flicker_phases, OUTPUTS_FLICKER_TYPES);
+	memcpy(phases+OUTPUTS_FLICKER_TYPES, _pattern_steps, CONFIG_PATTERNS);
+	memcpy(phases+OUTPUTS_FLICKER_TYPES+CONFIG_PATTERNS, _pattern_dividers, CONFIG_PATTERNS);
+}
+
+void outputs_warm_restore(const uint8_t state[NO_OUTPUTS], const uint8_t phases[OUTPUTS_PHASES]) {
+	memcpy(_outputs_state, state, NO_OUTPUTS);
+	memcpy(_pulse_states, state, NO_OUTPUTS); // do not fire pulses again
+	memcpy(_flicker_phases, phases, OUTPUTS_FLICKER_TYPES);
+	memcpy(_pattern_steps, phases+OUTPUTS_FLICKER_TYPES, CONFIG_PATTERNS);
+	memcpy(_pattern_dividers, phases+OUTPUTS_FLICKER_TYPES+CONFIG_PATTERNS, CONFIG_PATTERNS);
+	outputs_apply_state();
+	pwm_settle(); // outputs were lit before reset, do not fade-in again
+	pwm_apply();
+}
+
 void outputs_update(void) {
-	for (size_t i = 0; i < NO_OUTPUTS; i++) {
-		if (!_flicker_enabled[i])
-			continue;
-
-		_flicker_counters[i]++;
-		uint8_t flicker_type = _outputs_state[i] & 0x0F;
-		if (flicker_type >= sizeof(_flicker_periods)/sizeof(*_flicker_periods))
-			flicker_type = 0; // error: unknown flicker period → default flicker period
-		if (_flicker_counters[i] == _flicker_periods[flicker_type]) {
-			io_set_output_raw(i, true);
-		} else if (_flicker_counters[i] >= 2*_flicker_periods[flicker_type]) {
-			io_set_output_raw(i, false);
-			_flicker_counters[i] = 0;
+	if (_pulse_outputs) {
+		for (size_t i = 0; i < NO_OUTPUTS; i++) {
+			if (_pulse_counters[i] > 0) {
+				_pulse_counters[i]--;
+				if (_pulse_counters[i] == 0) {
+					io_set_output_raw(i, false);
+					_pulse_outputs &= ~(1 << i);
+				}
+			}
+		}
+	}
+
+	uint16_t state = 0;
+	uint16_t mask = 0;
+	for (size_t t = 0; t < OUTPUTS_FLICKER_TYPES; t++) {
+		_flicker_phases[t]++;
+		if (_flicker_phases[t] >= 2*_flicker_periods[t])
+			_flicker_phases[t] = 0;
+
+		mask |= _flicker_outputs[t];
+		if (_flicker_phases[t] >= _flicker_periods[t])
+			state |= _flicker_outputs[t];
+	}
+
+	for (size_t p = 0; p < CONFIG_PATTERNS; p++) {
+		_pattern_dividers[p]++;
+		if (_pattern_dividers[p] >= config_patterns[p].period) {
+			_pattern_dividers[p] = 0;
+			_pattern_steps[p] = (_pattern_steps[p]+1) % CONFIG_PATTERN_STEPS;
+		}
+
+		for (size_t q = 0; q < PATTERN_OFFSETS; q++) {
+			uint16_t outputs = _pattern_outputs[p][q];
+			if (outputs == 0)
+				continue;
+			mask |= outputs;
+			uint8_t step = (_pattern_steps[p] + q*(CONFIG_PATTERN_STEPS/PATTERN_OFFSETS)) % CONFIG_PATTERN_STEPS;
+			if ((config_patterns[p].steps >> step) & 1)
+				state |= outputs;
 		}
 	}
+
+	if (mask)
+		io_set_outputs_raw_mask(state, mask);
+}
+
+void outputs_flicker_sync(void) {
+	memset(_flicker_phases, 0, sizeof(_flicker_phases));
+	memset(_pattern_steps, 0, sizeof(_pattern_steps));
+	memset(_pattern_dividers, 0, sizeof(_pattern_dividers));
 }
@@ -1,19 +1,62 @@
 #ifndef _OUTPUTS_H_
 #define _OUTPUTS_H_
 
-/* Setting state of outputs: flickering, unzipping state, calling S-COM library.
+/* Setting state of outputs: flickering, unzipping state, calling encoders.
+ * Output state byte:
+ *  0x00-0x01: plain output
+ *  0x02-0x1F: pulse (length in lower 5 bits × 20 ms), output is turned off
+ *             by module, new pulse is started when state changes or by
+ *             outputs_fire_pulses
+ *  0x20-0x3F: dimmed output (level 0-31 in lower 5 bits), fading according to config
+ *  0x40-0x4F: flicker (type in lower 4 bits)
+ *  0x50-0x5F: pulse-train code (number of pulses in lower 4 bits)
+ *  0x60-0x7F: blink pattern from config (pattern in bits 0-2, offset in
+ *             quarters of pattern in bits 3-4)
+ *  0x80-0xFF: S-COM (code in lower 7 bits)
  */
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 #include "io.h"
+#include "config.h"
+
+#define OUTPUTS_FLICKER_TYPES 9
+#define OUTPUTS_PHASES (OUTPUTS_FLICKER_TYPES + 2*CONFIG_PATTERNS)
+
+#define OUTPUTS_PULSE_MIN 0x02
+#define OUTPUTS_PULSE_MAX 0x1F
+#define OUTPUTS_PULSE_UNIT 2 // 20 ms
+
+// Called when outputs are set by master: zipped (SET_OUTPUT, commit,
+// multi-output), masked (scenes) or pulses fired. outputs_set_full &
+// outputs_set_single are used by module itself (safe state, rules).
+extern void (*outputs_on_master_set)(void);
 
 // Data in zipped format according to protocol's «Set Output» command description:
 // https://github.com/kmzbrnoI/mtbbus-protocol/blob/master/modules/uni.md#module-specific-commands
 void outputs_set_zipped(uint8_t data[], size_t length);
 void outputs_set_full(uint8_t data[NO_OUTPUTS]);
+
+// Staged zipped state is applied later (all modules at once) by commit
+void outputs_stage_zipped(uint8_t data[], size_t length);
+bool outputs_commit_staged(void); // returns true iff any state was staged
+void outputs_set_masked(uint16_t mask, const uint8_t states[NO_OUTPUTS]); // other outputs kept
+void outputs_set_single(uint8_t output, uint8_t state);
+void outputs_fire_pulses(uint16_t mask); // start pulse again on outputs in pulse state
+
+// Warm restart: state & phases of flicker and patterns
+void outputs_warm_save(uint8_t state[NO_OUTPUTS], uint8_t phases[OUTPUTS_PHASES]);
+void outputs_warm_restore(const uint8_t state[NO_OUTPUTS], const uint8_t phases[OUTPUTS_PHASES]);
+
+void outputs_backup(void);
+void outputs_restore(void); // sets state saved by outputs_backup
+// Bit i = output i is in non-zero state
+extern uint16_t outputs_active;
+
 void outputs_update(void); // should be called each 10 ms
+void outputs_flicker_sync(void); // restart flicker & patterns of all outputs
 void outputs_apply_state(void);
 
 #endif
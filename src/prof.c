@@ -0,0 +1,91 @@
+#ifdef SUP_PROFILING
+
+#include <util/atomic.h>
+#include "prof.h"
+
+prof_stat_t prof_tasks[PROF_TASKS];
+prof_stat_t prof_isrs[PROF_ISRS];
+uint8_t prof_cpu_load = 0;
+uint8_t prof_cpu_load_max = 0;
+
+#define PROF_WINDOW 10 // 1 s (calls of prof_update)
+#define PROF_WINDOW_TICKS ((uint32_t)(F_CPU/8) * PROF_WINDOW / 10)
+
+volatile uint32_t _isr_ticks = 0; // total time spent in interrupts
+uint32_t _task_ticks = 0; // time spent in tasks in current window
+uint32_t _window_isr_ticks = 0; // _isr_ticks at start of window
+uint8_t _window_counter = 0;
+
+static inline void _stat_add(prof_stat_t* stat, uint16_t ticks) {
+	stat->sum += ticks;
+	if (stat->count < 0xFFFF)
+		stat->count++;
+	if (ticks > stat->max)
+		stat->max = ticks;
+}
+
+static inline void _stat_window(prof_stat_t* stat) {
+	stat->avg = (stat->count > 0) ? stat->sum / stat->count : 0;
+	stat->sum = 0;
+	stat->count = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+prof_mark_t prof_begin(void) {
+	prof_mark_t mark;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		mark.start = TCNT3;
+		mark.isr_ticks = _isr_ticks;
+	}
+	return mark;
+}
+
+void prof_end(uint8_t task, prof_mark_t mark) {
+	uint16_t end;
+	uint32_t isr_ticks;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		end = TCNT3;
+		isr_ticks = _isr_ticks;
+	}
+
+	uint16_t ticks = end - mark.start;
+	uint32_t in_isrs = isr_ticks - mark.isr_ticks;
+	ticks = (in_isrs < ticks) ? ticks - in_isrs : 0;
+
+	if (task < PROF_TASKS)
+		_stat_add(&prof_tasks[task], ticks);
+	_task_ticks += ticks;
+}
+
+void prof_isr_end(uint8_t isr, uint16_t start) {
+	uint16_t ticks = TCNT3 - start;
+	_stat_add(&prof_isrs[isr], ticks);
+	_isr_ticks += ticks;
+}
+
+void prof_update(void) {
+	_window_counter++;
+	if (_window_counter < PROF_WINDOW)
+		return;
+	_window_counter = 0;
+
+	uint32_t isr_ticks;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		isr_ticks = _isr_ticks;
+		for (uint8_t i = 0; i < PROF_ISRS; i++)
+			_stat_window(&prof_isrs[i]);
+	}
+	for (uint8_t i = 0; i < PROF_TASKS; i++)
+		_stat_window(&prof_tasks[i]);
+
+	uint32_t busy = _task_ticks + (isr_ticks - _window_isr_ticks);
+	_task_ticks = 0;
+	_window_isr_ticks = isr_ticks;
+
+	prof_cpu_load = (busy >= PROF_WINDOW_TICKS) ? 100 : (busy * 100) / PROF_WINDOW_TICKS;
+	if (prof_cpu_load > prof_cpu_load_max)
+		prof_cpu_load_max = prof_cpu_load;
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef _PROF_H_
+#define _PROF_H_
+
+/* Execution time profiling of main loop tasks & interrupts. Times are
+ * measured on free-running Timer 3 in its ticks (1 tick = 8 CPU cycles).
+ * Task times exclude interrupts which occured during the task.
+ * Enabled only when SUP_PROFILING is defined.
+ */
+
+#ifdef SUP_PROFILING
+
+#include <stdint.h>
+#include <avr/io.h>
+#include "sched.h"
+
+#define PROF_MTBBUS_RECEIVED SCHED_MAX_TASKS // after scheduler tasks
+#define PROF_TASKS (SCHED_MAX_TASKS+1)
+
+#define PROF_ISR_TIMER1 0
+#define PROF_ISR_TIMER2 1
+#define PROF_ISR_TIMER3A 2
+#define PROF_ISR_TIMER3B 3
+#define PROF_ISR_ADC 4
+#define PROF_ISR_UART_RX 5
+#define PROF_ISR_UART_TX 6
+#define PROF_ISR_EE_READY 7
+#define PROF_ISRS 8
+
+typedef struct {
+	uint32_t sum; // in current window
+	uint16_t count; // in current window
+	uint16_t max; // since start
+	uint16_t avg; // in last window
+} prof_stat_t;
+
+typedef struct {
+	uint16_t start;
+	uint32_t isr_ticks;
+} prof_mark_t;
+
+extern prof_stat_t prof_tasks[PROF_TASKS];
+extern prof_stat_t prof_isrs[PROF_ISRS];
+extern uint8_t prof_cpu_load; // % in last window
+extern uint8_t prof_cpu_load_max; // %
+
+// Measurement of main loop code
+prof_mark_t prof_begin(void);
+void prof_end(uint8_t task, prof_mark_t mark);
+
+// Measurement of interrupts (must be called with interrupts disabled)
+void prof_isr_end(uint8_t isr, uint16_t start);
+#define PROF_ISR_BEGIN() uint16_t _prof_start = TCNT3
+#define PROF_ISR_END(isr) prof_isr_end(isr, _prof_start)
+
+void prof_update(void); // should be called each 100 ms
+
+#else
+
+#define PROF_ISR_BEGIN()
+#define PROF_ISR_END(isr)
+
+#endif
+
+#endif
@@ -0,0 +1,167 @@
+#include <string.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include "pwm.h"
+#include "config.h"
+#include "prof.h"
+
+// Binary code modulation: bit-plane k of all dimmed outputs is present on
+// outputs for (PWM_UNIT << k) timer 2 ticks. Interrupt only writes
+// precomputed planes, so it's duration does not depend on number of dimmed
+// outputs.
+
+#define PWM_UNIT 2 // 139 us @ 1024× prescaler → period 8.9 ms (112 Hz)
+
+// Perceived brightness: output level (0-31) → duty cycle (0-63)
+static const uint8_t _gamma[32] PROGMEM = {
+	0, 1, 1, 1, 1, 1, 2, 2, 3, 4, 5, 6, 8, 9, 11, 13,
+	15, 17, 19, 21, 24, 27, 30, 33, 36, 39, 43, 46, 50, 54, 59, 63,
+};
+
+uint8_t _pwm_levels[NO_OUTPUTS] = {0, }; // current duty cycle
+uint8_t _pwm_targets[NO_OUTPUTS] = {0, };
+uint16_t _pwm_enabled = 0; // outputs in PWM mode
+uint16_t _pwm_releasing = 0; // outputs fading to plain state, released after fade
+uint16_t _pwm_release_on = 0; // plain state of released outputs
+
+volatile uint16_t _planes[PWM_BITS];
+volatile uint16_t _planes_mask = 0;
+volatile uint8_t _plane = 0;
+uint8_t _fade_counter = 0;
+bool _changed = false;
+
+static void _planes_update(void);
+
+///////////////////////////////////////////////////////////////////////////////
+
+void pwm_init(void) {
+	// Setup timer 2 for bit-planes
+	TCCR2 = (1 << WGM21) | (1 << CS22) | (1 << CS20); // CTC mode, 1024× prescaler
+	OCR2 = PWM_UNIT-1;
+	TIMSK |= (1 << OCIE2); // enable compare match interrupt
+}
+
+ISR(TIMER2_COMP_vect) {
+	PROF_ISR_BEGIN();
+	uint8_t plane = _plane;
+	if (_planes_mask)
+		io_set_outputs_raw_mask(_planes[plane], _planes_mask);
+	OCR2 = (PWM_UNIT << plane) - 1;
+	plane++;
+	_plane = (plane >= PWM_BITS) ? 0 : plane;
+	PROF_ISR_END(PROF_ISR_TIMER2);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+void pwm_output(uint8_t output, uint8_t level) {
+	if (output >= NO_OUTPUTS)
+		return;
+	if (level > PWM_LEVEL_MAX)
+		level = PWM_LEVEL_MAX;
+
+	_pwm_targets[output] = pgm_read_byte(&_gamma[level]);
+	_pwm_releasing &= ~(1 << output);
+	if (!(_pwm_enabled & (1 << output))) {
+		_pwm_enabled |= (1 << output);
+		_pwm_levels[output] = 0; // fade-in from dark
+	}
+	if (config_pwm_fade == 0)
+		_pwm_levels[output] = _pwm_targets[output];
+	_changed = true;
+}
+
+void pwm_disable_output(uint8_t output) {
+	if ((output >= NO_OUTPUTS) || (!(_pwm_enabled & (1 << output))))
+		return;
+	_pwm_enabled &= ~(1 << output);
+	_pwm_releasing &= ~(1 << output);
+	_pwm_levels[output] = 0;
+	_changed = true;
+}
+
+void pwm_fade_out(uint8_t output, bool on) {
+	if ((output >= NO_OUTPUTS) || (!(_pwm_enabled & (1 << output))))
+		return;
+	uint8_t target = (on) ? (1 << PWM_BITS)-1 : 0;
+	if ((config_pwm_fade == 0) || (_pwm_levels[output] == target)) {
+		pwm_disable_output(output);
+		return;
+	}
+
+	_pwm_targets[output] = target;
+	_pwm_releasing |= (1 << output);
+	if (on)
+		_pwm_release_on |= (1 << output);
+	else
+		_pwm_release_on &= ~(1 << output);
+}
+
+void pwm_settle(void) {
+	for (uint8_t i = 0; i < NO_OUTPUTS; i++)
+		_pwm_levels[i] = _pwm_targets[i];
+	_changed = true;
+}
+
+uint16_t pwm_releasing(void) {
+	return _pwm_releasing;
+}
+
+void pwm_apply(void) {
+	if (_changed) {
+		_changed = false;
+		_planes_update();
+	}
+}
+
+void pwm_update(void) {
+	// Fading: move each level by 1 towards target each ‹config_pwm_fade› calls
+	if (config_pwm_fade == 0)
+		return;
+	_fade_counter++;
+	if (_fade_counter < config_pwm_fade)
+		return;
+	_fade_counter = 0;
+
+	bool changed = false;
+	for (uint8_t i = 0; i < NO_OUTPUTS; i++) {
+		if (_pwm_levels[i] < _pwm_targets[i]) {
+			_pwm_levels[i]++;
+			changed = true;
+		} else if (_pwm_levels[i] > _pwm_targets[i]) {
+			_pwm_levels[i]--;
+			changed = true;
+		}
+
+		if ((_pwm_releasing & (1 << i)) && (_pwm_levels[i] == _pwm_targets[i])) {
+			// fade finished → output back to plain control
+			_pwm_enabled &= ~(1 << i);
+			_pwm_releasing &= ~(1 << i);
+			_pwm_levels[i] = 0;
+			io_set_output_raw(i, _pwm_release_on & (1 << i));
+			changed = true;
+		}
+	}
+
+	if (changed)
+		_planes_update();
+}
+
+static void _planes_update(void) {
+	uint16_t planes[PWM_BITS] = {0, };
+
+	for (int i = NO_OUTPUTS-1; i >= 0; i--) {
+		uint8_t level = (_pwm_enabled & (1 << i)) ? _pwm_levels[i] : 0;
+		for (uint8_t k = 0; k < PWM_BITS; k++) {
+			planes[k] <<= 1;
+			if (level & (1 << k))
+				planes[k] |= 1;
+		}
+	}
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		memcpy((uint16_t*)_planes, planes, sizeof(planes));
+		_planes_mask = _pwm_enabled;
+	}
+}
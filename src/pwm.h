@@ -0,0 +1,26 @@
+#ifndef _PWM_H_
+#define _PWM_H_
+
+/* Software PWM (dimming) of outputs with optional fading.
+ * Timer 2 is used exclusively by this unit.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "io.h"
+
+#define PWM_BITS 6 // 64 duty cycle steps
+#define PWM_LEVEL_MAX 31 // levels set via output state, mapped to duty cycle
+
+void pwm_init(void);
+void pwm_update(void); // should be called each 10 ms
+
+// Call pwm_apply after changing outputs to really apply changes
+void pwm_output(uint8_t output, uint8_t level);
+void pwm_disable_output(uint8_t output);
+void pwm_fade_out(uint8_t output, bool on); // fade to plain state, then disable
+uint16_t pwm_releasing(void); // outputs still fading to plain state
+void pwm_settle(void); // skip fading, all outputs jump to their target level
+void pwm_apply(void);
+
+#endif
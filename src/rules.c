@@ -0,0 +1,57 @@
+#include "rules.h"
+#include "config.h"
+#include "inputs.h"
+#include "outputs.h"
+
+uint8_t _rules_true = 0; // bit i = rule i condition is true & state_true was set
+uint16_t _rules_delay[CONFIG_RULES] = {0, }; // 10 ms periods condition holds
+
+static inline bool _rule_cond(const config_rule_t* rule, uint32_t vector) {
+	return ((vector & rule->on) == rule->on) && ((vector & rule->off) == 0);
+}
+
+void rules_warm_restore(void) {
+	uint32_t vector = inputs_logic_state | ((uint32_t)outputs_active << 16);
+
+	_rules_true = 0;
+	for (uint8_t i = 0; i < CONFIG_RULES; i++) {
+		config_rule_t* rule = &config_rules[i];
+		if ((rule->output < NO_OUTPUTS) && (_rule_cond(rule, vector))) {
+			_rules_true |= (1 << i);
+			_rules_delay[i] = 10*rule->delay;
+		}
+	}
+}
+
+void rules_update(bool tick) {
+	uint32_t vector = inputs_logic_state | ((uint32_t)outputs_active << 16);
+
+	for (uint8_t i = 0; i < CONFIG_RULES; i++) {
+		config_rule_t* rule = &config_rules[i];
+		if (rule->output >= NO_OUTPUTS)
+			continue;
+
+		bool cond = _rule_cond(rule, vector);
+
+		if (cond) {
+			if (_rules_true & (1 << i))
+				continue;
+			if (_rules_delay[i] < 10*rule->delay) {
+				if (tick)
+					_rules_delay[i]++;
+				continue;
+			}
+			_rules_true |= (1 << i);
+			outputs_set_single(rule->output, rule->state_true);
+		} else {
+			_rules_delay[i] = 0;
+			if (_rules_true & (1 << i)) {
+				_rules_true &= ~(1 << i);
+				if (rule->state_false != 0xFF)
+					outputs_set_single(rule->output, rule->state_false);
+			}
+		}
+
+		vector = inputs_logic_state | ((uint32_t)outputs_active << 16); // rules could be chained
+	}
+}
@@ -0,0 +1,19 @@
+#ifndef _RULES_H_
+#define _RULES_H_
+
+/* Module-local reactions of outputs to inputs according to rules in config.
+ * Rules act on edges of their condition only, so master could override
+ * outputs set by rules anytime.
+ */
+
+#include <stdbool.h>
+
+// ‹tick› = true iff called from 10 ms timer (delays are counted only then).
+// Call with ‹tick› = false when inputs change for immediate reaction.
+void rules_update(bool tick);
+
+// Restored outputs already reflect rules whose condition holds: mark them
+// as true without setting outputs, so they do not override master again.
+void rules_warm_restore(void);
+
+#endif
@@ -0,0 +1,60 @@
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include "sched.h"
+#include "prof.h"
+
+uint16_t sched_overruns[SCHED_MAX_TASKS] = {0, };
+uint16_t _ready_since[SCHED_MAX_TASKS]; // TCNT3 when task was seen ready first
+uint8_t _pending = 0; // bit i = task i seen ready & not yet run
+
+static inline uint16_t _now(void) {
+	uint16_t now;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { now = TCNT3; } // 16-bit register shared with ISRs
+	return now;
+}
+
+bool sched_pending(const sched_task_t tasks[], uint8_t count) {
+	sched_task_t task;
+	for (uint8_t i = 0; i < count; i++) {
+		memcpy_P(&task, &tasks[i], sizeof(task));
+		if (task.ready())
+			return true;
+	}
+	return false;
+}
+
+void sched_update(const sched_task_t tasks[], uint8_t count) {
+	sched_task_t task;
+	int8_t selected = -1;
+
+	for (uint8_t i = 0; i < count; i++) {
+		memcpy_P(&task, &tasks[i], sizeof(task));
+		if (!task.ready())
+			continue;
+		if (!(_pending & (1 << i))) {
+			_pending |= (1 << i);
+			_ready_since[i] = _now();
+		}
+		if (selected < 0)
+			selected = i;
+	}
+
+	if (selected < 0)
+		return;
+
+	memcpy_P(&task, &tasks[selected], sizeof(task));
+#ifdef SUP_PROFILING
+	prof_mark_t mark = prof_begin();
+	task.run();
+	prof_end(selected, mark);
+#else
+	task.run();
+#endif
+	_pending &= ~(1 << selected);
+
+	if ((task.deadline != SCHED_NO_DEADLINE) &&
+	    ((uint16_t)(_now() - _ready_since[selected]) > task.deadline) &&
+	    (sched_overruns[selected] < 0xFFFF))
+		sched_overruns[selected]++;
+}
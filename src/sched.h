@@ -0,0 +1,32 @@
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+/* Cooperative scheduler of main loop jobs. Tasks are given in table ordered
+ * by priority (first = highest). Single call of sched_update runs at most one
+ * task, so main loop gets back to MTBbus dispatch after each task.
+ * Timer 3 must run free with 8× prescaler (it is used as time base).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCHED_MAX_TASKS 8
+#define SCHED_US(us) ((uint16_t)((uint32_t)(us)*(F_CPU/8/1000)/1000)) // max ~35 ms
+#define SCHED_NO_DEADLINE 0
+
+typedef struct {
+	bool (*ready)(void); // true iff task has work to do
+	void (*run)(void);
+	uint16_t deadline; // max time from readiness to end of run (SCHED_US), 0 = none
+} sched_task_t;
+
+// Number of task runs which ended after deadline, saturating
+extern uint16_t sched_overruns[SCHED_MAX_TASKS];
+
+// ‹tasks› must be stored in PROGMEM
+void sched_update(const sched_task_t tasks[], uint8_t count);
+
+// Returns true iff any task is ready (may be called with interrupts disabled)
+bool sched_pending(const sched_task_t tasks[], uint8_t count);
+
+#endif
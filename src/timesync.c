@@ -0,0 +1,58 @@
+#include <stddef.h>
+#include "timesync.h"
+#include "clock.h"
+
+bool timesync_synced = false;
+bool timesync_drift_valid = false;
+int16_t timesync_drift = 0;
+
+uint32_t _sync_local = 0; // local clock at last sync
+uint32_t _sync_master = 0; // master time at last sync
+
+#define TIMESYNC_DRIFT_MIN_INTERVAL 1000 // ms between syncs to update drift
+#define TIMESYNC_DRIFT_MAX_INTERVAL 600000 // ms, longer intervals only restart estimation
+#define TIMESYNC_DRIFT_MAX 1000 // ppm, bigger differences = master time jump
+
+void timesync_received(uint32_t master_ms) {
+	uint32_t local = clock_ms();
+
+	if (timesync_synced) {
+		int32_t local_delta = local - _sync_local;
+		int32_t diff = (int32_t)(master_ms - _sync_master) - local_delta;
+
+		if (local_delta > TIMESYNC_DRIFT_MAX_INTERVAL) {
+			timesync_drift_valid = false;
+		} else if (local_delta >= TIMESYNC_DRIFT_MIN_INTERVAL) {
+			// |diff| ≤ local_delta * TIMESYNC_DRIFT_MAX / 10^6 ≤ 600 here, so
+			// diff * 10^6 fits into 32 bits
+			int32_t diff_max = local_delta / (1000000 / TIMESYNC_DRIFT_MAX);
+			if ((diff > diff_max) || (diff < -diff_max)) {
+				timesync_drift_valid = false; // master time changed, start estimating again
+			} else {
+				int32_t drift = (diff * 1000000) / local_delta;
+				if (!timesync_drift_valid)
+					timesync_drift = drift;
+				else
+					timesync_drift = (3*(int32_t)timesync_drift + drift) / 4; // smooth jitter of message processing
+				timesync_drift_valid = true;
+			}
+		}
+	}
+
+	_sync_local = local;
+	_sync_master = master_ms;
+	timesync_synced = true;
+}
+
+uint32_t timesync_ms(uint16_t *us) {
+	uint32_t local = clock_read(us);
+	if (!timesync_synced)
+		return local;
+	uint32_t since_sync = local - _sync_local;
+	if (!timesync_drift_valid)
+		return _sync_master + since_sync;
+	// since_sync × drift / 10^6 split to seconds & rest to fit into 32 bits
+	int32_t correction = ((int32_t)(since_sync / 1000) * timesync_drift) / 1000 +
+	                     ((int32_t)(since_sync % 1000) * timesync_drift) / 1000000;
+	return _sync_master + since_sync + correction;
+}
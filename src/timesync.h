@@ -0,0 +1,18 @@
+#ifndef _TIMESYNC_H_
+#define _TIMESYNC_H_
+
+/* Bus-wide time: master broadcasts it's time, module keeps offset & drift
+ * of it's own clock against master's time.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+extern bool timesync_synced; // at least one sync received
+extern bool timesync_drift_valid; // timesync_drift is estimated
+extern int16_t timesync_drift; // ppm of master time against local clock
+
+void timesync_received(uint32_t master_ms);
+uint32_t timesync_ms(uint16_t *us); // synchronized time (local clock when not synced)
+
+#endif
@@ -0,0 +1,43 @@
+#include <string.h>
+#include "warm.h"
+#include "outputs.h"
+#include "inputs.h"
+#include "rules.h"
+#include "../lib/crc16modbus.h"
+
+#define WARM_MAGIC 0x5741 // change when warm_state_t changes
+
+typedef struct {
+	uint16_t magic;
+	uint8_t outputs[NO_OUTPUTS];
+	uint8_t phases[OUTPUTS_PHASES];
+	uint16_t inputs;
+	uint16_t crc; // must be last
+} warm_state_t;
+
+// Bootloader could overwrite part of this section, crc is checked
+__attribute__((section(".noinit"))) warm_state_t warm_state;
+
+static uint16_t _warm_crc(void) {
+	return crc16modbus_bytes(0, &warm_state, sizeof(warm_state)-sizeof(warm_state.crc));
+}
+
+void warm_save(void) {
+	warm_state.magic = WARM_MAGIC;
+	outputs_warm_save(warm_state.outputs, warm_state.phases);
+	warm_state.inputs = inputs_logic_state;
+	warm_state.crc = _warm_crc();
+}
+
+bool warm_restore(void) {
+	if ((warm_state.magic != WARM_MAGIC) || (warm_state.crc != _warm_crc()))
+		return false;
+	inputs_warm_restore(warm_state.inputs);
+	outputs_warm_restore(warm_state.outputs, warm_state.phases);
+	rules_warm_restore();
+	return true;
+}
+
+void warm_invalidate(void) {
+	warm_state.magic = 0;
+}
@@ -0,0 +1,15 @@
+#ifndef _WARM_H_
+#define _WARM_H_
+
+/* Warm restart: state of outputs & inputs is kept in RAM section which is
+ * not initialized after reset. After watchdog (or software) reset, the state
+ * is restored, so outputs do not fall to safe state.
+ */
+
+#include <stdbool.h>
+
+void warm_save(void); // should be called each 10 ms
+bool warm_restore(void); // returns true iff valid state was restored
+void warm_invalidate(void);
+
+#endif